@@ -929,6 +929,14 @@ std::vector<std::string> assembleIR(IRprogram& IR)
             variableMap[op.operands[1]] = VarData{/*true, */stackTop, op.type};
           }
 
+          // Intrinsics declared in mc3.h are instructions, not functions
+          if (op.operands[0] == "__mc3_wait")
+          {
+            argStack.clear();
+            assembly.emplace_back("wait");
+            break;
+          }
+
           assembly.insert(assembly.end(), {
             "sub", stackSegmentReg, std::to_string(stackTop+op.type.size+2),
             "set", "d0", instructionSegmentReg,
@@ -8,7 +8,7 @@
   #define HDD_SELECTED_WORD (*(volatile uint8_t*)(0xFF04))
   #define HDD_RW_WORD (*(volatile uint16_t*)(0xFF05))
 
-  #define TTY (*(volatile uint8_t*)(0xFF07))
+  #define TTY (*(volatile uint8_t*)(0xFF07)) /* Reads the next input character, 0 while there is none */
 
   #define VGA (*(volatile uint8_t*)(0xFF08))
   #define VGA_WRITE_SCREEN_WIDTH (*(volatile uint16_t*)(0xFF09))
@@ -18,6 +18,22 @@
   #define VGA_VRAM_PTR_24_BIT (*(volatile uint8_t*)(0xFF09))
   #define VGA_VRAM_POINTED_DATA (*(volatile uint16_t*)(0xFF0C))
 
+  /* Commands for VGA_PUSH_COMMAND, drawing one byte per pixel. They leave the VGA in pixel input mode */
+  #define VGA_AUTO_INCREMENT 0x80 /* Pixel input, the VRAM pointer moves on after every pixel */
+  #define VGA_FILL_RECT 0x81 /* VGA_BLIT_X, _Y, _WIDTH, _HEIGHT with VGA_BLIT_COLOR */
+  #define VGA_COPY_RECT 0x82 /* VGA_BLIT_WIDTH x VGA_BLIT_HEIGHT from VGA_BLIT_SOURCE_X, _Y to VGA_BLIT_X, _Y */
+  #define VGA_BLIT_SPRITE 0x83 /* VGA_BLIT_SPRITE_ADDRESS to VGA_BLIT_X, _Y through VGA_BLIT_PALETTE */
+  #define VGA_BLIT_X (*(volatile uint16_t*)(0xFF2E))
+  #define VGA_BLIT_Y (*(volatile uint16_t*)(0xFF30))
+  #define VGA_BLIT_WIDTH (*(volatile uint16_t*)(0xFF32))
+  #define VGA_BLIT_HEIGHT (*(volatile uint16_t*)(0xFF34))
+  #define VGA_BLIT_COLOR (*(volatile uint8_t*)(0xFF36))
+  #define VGA_BLIT_SOURCE_X (*(volatile uint16_t*)(0xFF37))
+  #define VGA_BLIT_SOURCE_Y (*(volatile uint16_t*)(0xFF39))
+  #define VGA_BLIT_SPRITE_ADDRESS (*(volatile uint16_t*)(0xFF3B))
+  #define VGA_BLIT_PALETTE (*(volatile uint16_t*)(0xFF3D)) /* 0 if the sprite holds colors */
+  #define VGA_BLIT_TRANSPARENT (*(volatile uint8_t*)(0xFF3F)) /* Sprite index that is not drawn */
+
   #define KEYBOARD (*(volatile uint8_t*)(0xFF0E))
   #define KEYBOARD_TOP_SCANCODE (*(volatile uint8_t*)(0xFF0E))
   #define KEYBOARD_INSTRUCTION_OPCODE (*(volatile uint8_t*)(0xFF0E))
@@ -28,4 +44,35 @@
 
   #define SPEAKER (*(volatile uint8_t*)(0xFF14))
 
+  /* Counts are latched by PERF_COUNTER_STOP or PERF_COUNTER_SAMPLE and exclude the instruction that wrote the command */
+  #define PERF_COUNTER (*(volatile uint8_t*)(0xFF17))
+  #define PERF_COUNTER_CONTROL (*(volatile uint8_t*)(0xFF17))
+  #define PERF_COUNTER_INSTRUCTIONS (*(volatile uint32_t*)(0xFF18))
+  #define PERF_COUNTER_CYCLES (*(volatile uint32_t*)(0xFF1C))
+  #define PERF_COUNTER_START 1
+  #define PERF_COUNTER_STOP 2
+  #define PERF_COUNTER_SAMPLE 3
+  #define PERF_START() (PERF_COUNTER_CONTROL = PERF_COUNTER_START)
+  #define PERF_STOP() (PERF_COUNTER_CONTROL = PERF_COUNTER_STOP)
+
+  /* Copies finish before the write to DMA_CONTROL does, DMA_STATUS then reads DMA_DONE or DMA_ERROR */
+  #define DMA (*(volatile uint8_t*)(0xFF20))
+  #define DMA_SOURCE (*(volatile uint32_t*)(0xFF20))
+  #define DMA_DESTINATION (*(volatile uint32_t*)(0xFF24))
+  #define DMA_LENGTH (*(volatile uint16_t*)(0xFF28))
+  #define DMA_MODE (*(volatile uint8_t*)(0xFF2A))
+  #define DMA_CONTROL (*(volatile uint8_t*)(0xFF2B))
+  #define DMA_STATUS (*(volatile uint8_t*)(0xFF2B))
+  #define DMA_INTERRUPT_ID (*(volatile uint16_t*)(0xFF2C))
+  #define DMA_RAM_TO_RAM 0
+  #define DMA_HDD_TO_RAM 1
+  #define DMA_RAM_TO_VGA 2
+  #define DMA_START 1
+  #define DMA_DONE 1
+  #define DMA_ERROR 2
+
+  /* Compiled to a single WAIT instruction, which sleeps until the next interrupt has been handled */
+  void __mc3_wait(void);
+  #define WAIT_FOR_INTERRUPT() __mc3_wait()
+
   #endif /* _MC3_H */
@@ -868,6 +868,11 @@ std::vector<uint8_t> assemble(
       program[pos >> 1].data[0] = (uint8_t(Opcode::OpOnly) << 3) | ((uint16_t)OnlyOpcode::IRet >> 8);
       program[pos >> 1].data[1] = (uint8_t)OnlyOpcode::IRet;
       pos += 2;
+    } else if (tokens[t] == "wait")
+    {
+      program[pos >> 1].data[0] = (uint8_t(Opcode::OpOnly) << 3) | ((uint16_t)OnlyOpcode::Wait >> 8);
+      program[pos >> 1].data[1] = (uint8_t)OnlyOpcode::Wait;
+      pos += 2;
     } else if (tokens[t] == "inc")
     {
       Reg mainReg = getReg(tokens[++t]);
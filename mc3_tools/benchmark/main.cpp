@@ -0,0 +1,585 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../mc3_utils.hpp"
+
+#include "../emulator/emu-utils/ram.hpp"
+#include "../emulator/virt_machine.hpp"
+#include "../emulator/jit.hpp"
+#include "../emulator/perf_counter.hpp"
+
+struct Workload
+{
+  std::string name;
+  std::vector<uint8_t> program;
+};
+
+// opcode(5) + reg(3) + value(8)
+void emit(std::vector<uint8_t>& program, Opcode opcode, Reg reg, uint8_t second)
+{
+  program.push_back(((uint8_t)opcode << 3) | (uint8_t)reg);
+  program.push_back(second);
+}
+
+// reg(3) + value(4) + useValue(1)
+uint8_t reg3(Reg lhs, uint8_t value)
+{
+  return ((uint8_t)lhs << 5) | ((value & 0xF) << 1) | 1;
+}
+
+// reg(3) + reg(3) + 00
+uint8_t reg3(Reg lhs, Reg rhs)
+{
+  return ((uint8_t)lhs << 5) | ((uint8_t)rhs << 2);
+}
+
+// reg(2) + signedValue(6)
+uint8_t memOperand(Reg base, int8_t offset)
+{
+  return ((uint8_t)base << 6) | (offset & 0x3F);
+}
+
+// The shift-and-add sequence mc3cc emits for SetMultiplication, restarted forever
+Workload multiplyWorkload()
+{
+  Workload workload{"multiply"};
+  std::vector<uint8_t>& p = workload.program;
+
+  emit(p, Opcode::AddVal, Reg::m2, 1);                  // 0x00 add m2 1, so restarts are not an idle loop
+  emit(p, Opcode::SetVal, Reg::d0, 0xBE);               // 0x02 set d0 0xBEEF
+  emit(p, Opcode::LshReg, Reg::d0, reg3(Reg::d0, 8));   // 0x04
+  emit(p, Opcode::OrVal, Reg::d0, 0xEF);                // 0x06
+  emit(p, Opcode::SetVal, Reg::d1, 0x5B);               // 0x08 set d1 0x5B
+  emit(p, Opcode::SetVal, Reg::d2, 0x00);               // 0x0A set d2 0
+  emit(p, Opcode::SetVal, Reg::m3, 0x16);               // 0x0C set m3 skip
+  emit(p, Opcode::SetVal, Reg::m0, 0x10);               // 0x0E set m0 loop
+  emit(p, Opcode::AndReg, Reg::d3, reg3(Reg::d0, 1));   // 0x10 loop: and d3 d0 1
+  emit(p, Opcode::JmpZ, Reg::m3, 0x00);                 // 0x12 jz m3
+  emit(p, Opcode::AddReg, Reg::d2, reg3(Reg::d2, Reg::d1)); // 0x14 add d2 d1
+  emit(p, Opcode::LshReg, Reg::d1, reg3(Reg::d1, 1));   // 0x16 skip: lsh d1 1
+  emit(p, Opcode::RshReg, Reg::d0, reg3(Reg::d0, 1));   // 0x18 rsh d0 1
+  emit(p, Opcode::JmpNz, Reg::m0, 0x00);                // 0x1A jnz m0
+  emit(p, Opcode::JmpZ, Reg::m1, 0x00);                 // 0x1C jz m1
+
+  return workload;
+}
+
+// A word at a time copy of 256 bytes, restarted forever
+Workload memcpyWorkload()
+{
+  Workload workload{"memcpy"};
+  std::vector<uint8_t>& p = workload.program;
+
+  emit(p, Opcode::SetVal, Reg::m1, 0x00);                    // 0x00 set m1 0
+  emit(p, Opcode::SetVal, Reg::m0, 0x20);                    // 0x02 set m0 0x2000
+  emit(p, Opcode::LshReg, Reg::m0, reg3(Reg::m0, 8));        // 0x04
+  emit(p, Opcode::SetVal, Reg::m3, 0x30);                    // 0x06 set m3 0x3000
+  emit(p, Opcode::LshReg, Reg::m3, reg3(Reg::m3, 8));        // 0x08
+  emit(p, Opcode::SetVal, Reg::d1, 0x80);                    // 0x0A set d1 0x80
+  emit(p, Opcode::SetVal, Reg::d2, 0x0E);                    // 0x0C set d2 loop
+  emit(p, Opcode::LodW, Reg::d0, memOperand(Reg::m0, 0));    // 0x0E loop: set d0 2@m0
+  emit(p, Opcode::StrW, Reg::d0, memOperand(Reg::m3, 0));    // 0x10 put d0 2@m3
+  emit(p, Opcode::AddVal, Reg::m0, 2);                       // 0x12 add m0 2
+  emit(p, Opcode::AddVal, Reg::m3, 2);                       // 0x14 add m3 2
+  emit(p, Opcode::SubVal, Reg::d1, 1);                       // 0x16 dec d1
+  emit(p, Opcode::JmpNz, Reg::d2, 0x00);                     // 0x18 jnz d2
+  emit(p, Opcode::JmpZ, Reg::m1, 0x00);                      // 0x1A jz m1
+
+  return workload;
+}
+
+// Increments a local variable through the far stack access and far jump
+// sequences assemble_ir.hpp emits, restarted forever
+Workload stackWorkload()
+{
+  Workload workload{"stack"};
+  std::vector<uint8_t>& p = workload.program;
+
+  emit(p, Opcode::SetVal, Reg::m2, 0x40);                    // 0x00 set m2 0x4000
+  emit(p, Opcode::LshReg, Reg::m2, reg3(Reg::m2, 8));        // 0x02
+  emit(p, Opcode::SubVal, Reg::m2, 8);                       // 0x04 loop: sub m2 8
+  emit(p, Opcode::LodW, Reg::d0, memOperand(Reg::m2, -32));  // 0x06 set d0 2@m2-32
+  emit(p, Opcode::AddVal, Reg::m2, 8);                       // 0x08 add m2 8
+  emit(p, Opcode::AddVal, Reg::d0, 1);                       // 0x0A add d0 1
+  emit(p, Opcode::SubVal, Reg::m2, 8);                       // 0x0C sub m2 8
+  emit(p, Opcode::StrW, Reg::d0, memOperand(Reg::m2, -32));  // 0x0E put d0 2@m2-32
+  emit(p, Opcode::AddVal, Reg::m2, 8);                       // 0x10 add m2 8
+  emit(p, Opcode::AddReg, Reg::d1, reg3(Reg::m0, 0));        // 0x12 set d1 m0
+  emit(p, Opcode::AddVal, Reg::d1, 0x04);                    // 0x14 add d1 loop-text
+  emit(p, Opcode::JmpNz, Reg::d1, 0x00);                     // 0x16 jnz d1
+
+  return workload;
+}
+
+struct BenchMachine
+{
+  VirtMachine vm;
+  RAM<0xFF00> ram;
+
+  BenchMachine(const Workload& workload)
+  {
+    vm.mapMemory(0x0000, 0xFEFF, ram.memory);
+    std::copy(workload.program.begin(), workload.program.end(), ram.memory);
+    vm.invalidateDecodeCache();
+  }
+};
+
+// Returns host nanoseconds per emulated instruction
+template <typename F>
+double measure(const Workload& workload, uint64_t instructions, F step)
+{
+  std::unique_ptr<BenchMachine> machine = std::make_unique<BenchMachine>(workload);
+
+  auto start = std::chrono::steady_clock::now();
+  step(machine->vm, instructions);
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(end - start).count() / instructions;
+}
+
+void report(const std::string& workload, const std::string& variant, double nsPerInstruction)
+{
+  std::cout << std::left << std::setw(10) << workload << std::setw(24) << variant <<
+    std::right << std::fixed << std::setprecision(2) << std::setw(8) << nsPerInstruction << " ns/instruction  " <<
+    std::setw(8) << 1000.0 / nsPerInstruction << " MIPS\n";
+}
+
+// Compares pc, registers, flags, the instruction and memory cycle counts and RAM
+bool sameState(const BenchMachine& first, const BenchMachine& second)
+{
+  const VirtMachine& a = first.vm;
+  const VirtMachine& b = second.vm;
+  const VirtMachine::Flags flagsA = a.getFlags();
+  const VirtMachine::Flags flagsB = b.getFlags();
+
+  return a.pc == b.pc && std::equal(a.regs, a.regs + 8, b.regs) && a.instructionCount == b.instructionCount &&
+    a.memoryCycles == b.memoryCycles &&
+    flagsA.carry == flagsB.carry && flagsA.overflow == flagsB.overflow && flagsA.zero == flagsB.zero &&
+    flagsA.sign == flagsB.sign && flagsA.bitsSet == flagsB.bitsSet &&
+    std::memcmp(first.ram.memory, second.ram.memory, 0xFF00) == 0;
+}
+
+#ifdef MC3EMU_JIT
+// Runs the workload on the interpreter and the JIT and compares the resulting machine state
+bool jitMatchesInterpreter(const Workload& workload, uint64_t instructions)
+{
+  std::unique_ptr<BenchMachine> interpreted = std::make_unique<BenchMachine>(workload);
+  std::unique_ptr<BenchMachine> translated = std::make_unique<BenchMachine>(workload);
+  std::unique_ptr<Jit> jit = std::make_unique<Jit>(translated->vm);
+
+  // Uneven slices so blocks get cut short by the budget
+  for (uint64_t executed = 0, slice = 1; executed < instructions; executed += slice, slice = slice * 3 % 1009 + 1)
+  {
+    slice = std::min(slice, instructions - executed);
+    interpreted->vm.run<VirtMachine::Dispatch::Switch>(slice);
+    jit->run(slice);
+  }
+
+  return sameState(*interpreted, *translated);
+}
+
+// Times count additions with the performance counter from inside a translated
+// block, which has to latch the same counts as the interpreter: count + 3
+// instructions, with the start store, the load and the instruction setting up
+// the stop
+bool jitPerfCounterMatches(uint8_t count)
+{
+  Workload workload{"perf counter"};
+  std::vector<uint8_t>& p = workload.program;
+
+  emit(p, Opcode::SetVal, Reg::m0, 0xFF);                    // set m0 0xFF17
+  emit(p, Opcode::LshReg, Reg::m0, reg3(Reg::m0, 8));
+  emit(p, Opcode::OrVal, Reg::m0, 0x17);
+  emit(p, Opcode::SetVal, Reg::d0, PerfCounter::Start);     // set d0 Start
+  emit(p, Opcode::StrB, Reg::d0, memOperand(Reg::m0, 0));   // put d0 1@m0
+  for (uint8_t i = 0; i < count; i++)
+  {
+    emit(p, Opcode::AddVal, Reg::d1, 1);                    // add d1 1
+  }
+  emit(p, Opcode::LodW, Reg::d2, memOperand(Reg::m0, 1));   // set d2 2@m0+1, one memory cycle more per load
+  emit(p, Opcode::SetVal, Reg::d0, PerfCounter::Stop);      // set d0 Stop
+  emit(p, Opcode::StrB, Reg::d0, memOperand(Reg::m0, 0));   // put d0 1@m0
+  emit(p, Opcode::XorReg, Reg::d3, reg3(Reg::d3, Reg::d3)); // xor d3 d3
+  emit(p, Opcode::JmpZ, Reg::m1, 0x00);                     // jz m1, every round latches the same counts
+
+  const uint64_t instructions = 10000;
+  uint32_t latched[2][2];
+  for (int translated = 0; translated < 2; translated++)
+  {
+    std::unique_ptr<BenchMachine> machine = std::make_unique<BenchMachine>(workload);
+    PerfCounter perfCounter(machine->vm);
+    machine->vm.connectDevice(&perfCounter, 0xFF17, 0xFF1F);
+
+    if (translated)
+    {
+      Jit jit(machine->vm);
+      jit.run(instructions);
+    } else
+    {
+      machine->vm.run<VirtMachine::Dispatch::Switch>(instructions);
+    }
+
+    for (int counter = 0; counter < 2; counter++)
+    {
+      latched[translated][counter] = 0;
+      for (uint8_t byte = 0; byte < 4; byte++)
+      {
+        latched[translated][counter] |= uint32_t(perfCounter.read(1 + counter * 4 + byte)) << (byte * 8);
+      }
+    }
+  }
+
+  return latched[0][0] == count + 3u && latched[1][0] == latched[0][0] && latched[1][1] == latched[0][1];
+}
+
+// Raises the interrupt written to it, so stores from translated code can end
+// their block with an interrupt pending. Reads count up
+struct InterruptDevice: IODevice
+{
+  VirtMachine& vm;
+  uint8_t reads = 0;
+
+  explicit InterruptDevice(VirtMachine& vm): vm(vm) {}
+
+  uint8_t read(uint16_t address) override
+  {
+    return reads++;
+  }
+
+  void write(uint16_t address, uint8_t value) override
+  {
+    vm.deviceInterrupt(value);
+  }
+};
+
+// Random code from 0x0000 to 0x0EFF: every opcode with random operands, mixed
+// with the jump and stack access sequences that get fused, over registers and
+// data at the edges of carry and overflow. Some stores are aimed at the code
+// just ahead and at the interrupt device, so they rewrite translated blocks and
+// raise interrupts. Jumps go wherever the registers point, odd addresses
+// included. The interrupt handler at 0x0F00 does a little arithmetic and returns
+Workload randomWorkload(std::mt19937& rng)
+{
+  Workload workload{"random"};
+  std::vector<uint8_t>& p = workload.program;
+
+  const Reg registers[] = {Reg::m0, Reg::m1, Reg::m2, Reg::m3, Reg::d0, Reg::d1, Reg::d2, Reg::d3};
+  auto reg = [&]()
+  {
+    return registers[rng() % 8];
+  };
+  auto base = [&]()
+  {
+    return registers[rng() % 4];
+  };
+  auto setAddress = [&](Reg target, uint16_t address)
+  {
+    emit(p, Opcode::SetVal, target, address >> 8);
+    emit(p, Opcode::LshReg, target, reg3(target, 8));
+    emit(p, Opcode::OrVal, target, address);
+  };
+
+  while (p.size() < 0x0F00)
+  {
+    switch (rng() % 10)
+    {
+      case 0: {
+        // set dX rY; add dX imm; jmp dX
+        const Reg target = reg();
+        emit(p, Opcode::AddReg, target, reg3(reg(), 0));
+        emit(p, rng() % 2 ? Opcode::AddVal : Opcode::SubVal, target, rng());
+        emit(p, Opcode(uint8_t(Opcode::JmpZ) + rng() % 8), target, 0);
+        break;
+      } case 1: {
+        // sub rX N; set/put rY size@rX-offset; add rX N
+        const Reg pointer = base();
+        const uint8_t size = rng() % 16;
+        emit(p, Opcode::SubVal, pointer, size);
+        emit(p, Opcode(uint8_t(Opcode::LodB) + rng() % 4), reg(), memOperand(pointer, -int8_t(rng() % 32)));
+        emit(p, Opcode::AddVal, pointer, size);
+        break;
+      } case 2: {
+        emit(p, Opcode(uint8_t(Opcode::LodB) + rng() % 4), reg(), memOperand(base(), rng()));
+        break;
+      } case 3: {
+        // A store into the next few instructions, usually in the same block, or anywhere in the code
+        const Reg pointer = base();
+        setAddress(pointer, rng() % 2 ? p.size() + 8 + rng() % 16 : rng() % 0x0F00);
+        emit(p, rng() % 2 ? Opcode::StrB : Opcode::StrW, reg(), memOperand(pointer, 0));
+        break;
+      } case 4: {
+        const Reg pointer = base();
+        setAddress(pointer, 0xFF40 + rng() % 16);
+        emit(p, Opcode::StrB, reg(), memOperand(pointer, 0));
+        break;
+      } case 5: {
+        // Anywhere in the code, odd addresses included
+        const Reg target = reg();
+        setAddress(target, rng() % 0x0F00);
+        emit(p, Opcode(uint8_t(Opcode::JmpZ) + rng() % 8), target, 0);
+        break;
+      } default:
+        p.push_back(rng());
+        p.push_back(rng());
+        break;
+    }
+  }
+  p.resize(0x0F00);
+
+  emit(p, Opcode::AddVal, Reg::d1, 1);
+  emit(p, Opcode::XorReg, Reg::d2, reg3(Reg::d0, Reg::d2));
+  emit(p, Opcode::OpOnly, Reg::m0, uint8_t(OnlyOpcode::IRet));
+
+  const uint16_t edges[] = {0x0000, 0x0001, 0x7FFE, 0x7FFF, 0x8000, 0x8001, 0xFFFE, 0xFFFF};
+  p.resize(0x2000);
+  for (int i = 0; i < 0x1000; i++)
+  {
+    const uint16_t value = rng() % 2 ? edges[rng() % 8] : uint16_t(rng());
+    p.push_back(value);
+    p.push_back(value >> 8);
+  }
+
+  return workload;
+}
+
+// Runs random programs on run<Switch> without fusion and on the JIT, which
+// still falls back to fused heads, in uneven slices with hardware interrupts in
+// between, and compares the machines after every slice
+bool jitMatchesRandomPrograms(int programs, uint64_t instructions)
+{
+  std::mt19937 rng(1);
+  for (int program = 0; program < programs; program++)
+  {
+    const Workload workload = randomWorkload(rng);
+    std::unique_ptr<BenchMachine> interpreted = std::make_unique<BenchMachine>(workload);
+    std::unique_ptr<BenchMachine> translated = std::make_unique<BenchMachine>(workload);
+    InterruptDevice interpretedDevice(interpreted->vm);
+    InterruptDevice translatedDevice(translated->vm);
+    interpreted->vm.connectDevice(&interpretedDevice, 0xFF40, 0xFF4F);
+    translated->vm.connectDevice(&translatedDevice, 0xFF40, 0xFF4F);
+    interpreted->vm.fusionEnabled = false;
+
+    const uint16_t starts[] = {uint16_t(rng() % 0x0F00), uint16_t(0x2000 + rng() % 0x2000), uint16_t(0xFF40 + rng() % 16),
+      uint16_t(rng())};
+    const uint16_t edges[] = {0x0000, 0x0001, 0x7FFF, 0x8000, 0xFFFF};
+    for (int i = 0; i < 8; i++)
+    {
+      interpreted->vm.regs[i] = translated->vm.regs[i] = i < 4 ? starts[(i + program) % 4] : edges[rng() % 5];
+    }
+    interpreted->vm.intVec = translated->vm.intVec = 0x0F00;
+
+    std::unique_ptr<Jit> jit = std::make_unique<Jit>(translated->vm);
+    for (uint64_t executed = 0; executed < instructions && !interpreted->vm.halted();)
+    {
+      if (rng() % 4 == 0)
+      {
+        const uint16_t interruptID = rng();
+        interpreted->vm.hardwareInterrupt(interruptID);
+        translated->vm.hardwareInterrupt(interruptID);
+      }
+
+      const uint64_t slice = rng() % 4 == 0 ? 1 + rng() % 8 : 1 + rng() % 400;
+      const uint64_t interpretedSteps = interpreted->vm.run<VirtMachine::Dispatch::Switch>(slice);
+      const uint64_t translatedSteps = jit->run(slice);
+      if (interpretedSteps != translatedSteps || !sameState(*interpreted, *translated))
+      {
+        std::cout << "random program " << program << " differs after " << interpreted->vm.instructionCount <<
+          " instructions\n";
+        return false;
+      }
+
+      // Waiting for an interrupt or spinning in an idle loop, the next slice brings one
+      executed += std::max<uint64_t>(interpretedSteps, 1);
+    }
+  }
+
+  return true;
+}
+#endif
+
+// Prevents the compiler from removing flag reads
+volatile uint8_t flagSink;
+
+int main(int argc, char* argv[])
+{
+  uint64_t instructions = 50000000;
+  if (argc > 1)
+  {
+    instructions = std::stoull(argv[1]);
+  }
+
+  const Workload workloads[] = {multiplyWorkload(), memcpyWorkload(), stackWorkload()};
+
+#ifdef MC3EMU_JIT
+  if (!jitPerfCounterMatches(40))
+  {
+    std::cout << "perf counter: JIT counts differ from the interpreter\n";
+    return 1;
+  }
+
+  if (!jitMatchesRandomPrograms(200, 20000))
+  {
+    std::cout << "random programs: JIT state differs from the interpreter\n";
+    return 1;
+  }
+#endif
+
+  for (const Workload& workload: workloads)
+  {
+    // The baseline: the loop updateFlags ran on the written register after
+    // nearly every instruction before the flags were computed lazily
+    report(workload.name, "eager bitsSet loop", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      VirtMachine::Flags flags = {0, 0, 0, 0, 0};
+      for (uint64_t i = 0; i < count; i++)
+      {
+        const uint16_t& value = vm.regs[vm.read(vm.pc) & 0x07];
+        vm.tickClock();
+
+        flags.zero = value == 0;
+        flags.sign = value >> 15;
+        flags.bitsSet = 0;
+        for (int bit = 0; bit < 16; bit++)
+        {
+          if (value & (1 << bit))
+          {
+            flags.bitsSet++;
+          }
+        }
+        flagSink = flags.bitsSet | flags.zero << 6 | flags.sign << 7;
+      }
+    }));
+
+    // Materializes the flags after every instruction through getFlags(), which
+    // counts bitsSet with popcount instead of the loop updateFlags used to run
+    report(workload.name, "eager getFlags()", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      for (uint64_t i = 0; i < count; i++)
+      {
+        vm.tickClock();
+        flagSink = vm.getFlags().bitsSet;
+      }
+    }));
+
+    report(workload.name, "lazy flags", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      for (uint64_t i = 0; i < count; i++)
+      {
+        vm.tickClock();
+      }
+    }));
+
+    report(workload.name, "run()", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.run(count);
+    }));
+
+    report(workload.name, "run() no decode cache", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.decodeCacheEnabled = false;
+      vm.run(count);
+    }));
+
+    report(workload.name, "run() no fusion", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.fusionEnabled = false;
+      vm.run(count);
+    }));
+
+    report(workload.name, "run() profiled", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      std::vector<uint64_t> counts(0x8000);
+      vm.executionCounts = counts.data();
+      vm.run<VirtMachine::defaultDispatch, VirtMachine::Features::Profile>(count);
+    }));
+
+    report(workload.name, "run() traced", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      TraceBuffer trace(1 << 16);
+      vm.trace = &trace;
+      vm.run<VirtMachine::defaultDispatch, VirtMachine::Features::Trace>(count);
+      vm.trace = nullptr;
+    }));
+
+    // Nothing is protected and there are no breakpoints, this is only the cost of the checks
+    report(workload.name, "run() with checks", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.run<VirtMachine::defaultDispatch, VirtMachine::Features::Protect | VirtMachine::Features::Breakpoints>(count);
+    }));
+
+    report(workload.name, "run() with stats", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.run<VirtMachine::defaultDispatch, VirtMachine::Features::Stats>(count);
+    }));
+
+    report(workload.name, "switch dispatch", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.run<VirtMachine::Dispatch::Switch>(count);
+    }));
+
+#ifdef MC3EMU_THREADED_DISPATCH
+    report(workload.name, "threaded dispatch", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      vm.run<VirtMachine::Dispatch::Threaded>(count);
+    }));
+#endif
+
+#ifdef MC3EMU_JIT
+    if (!jitMatchesInterpreter(workload, 1000000))
+    {
+      std::cout << workload.name << ": JIT state differs from the interpreter\n";
+      return 1;
+    }
+
+    report(workload.name, "jit", measure(workload, instructions, [](VirtMachine& vm, uint64_t count)
+    {
+      Jit jit(vm);
+      jit.run(count);
+    }));
+#endif
+  }
+
+  // Starting a run from a save state costs one save when the state is taken and
+  // one load per run. Both machines have to go on exactly the same way afterwards
+  for (const Workload& workload: workloads)
+  {
+    std::unique_ptr<BenchMachine> source = std::make_unique<BenchMachine>(workload);
+    std::unique_ptr<BenchMachine> target = std::make_unique<BenchMachine>(workload);
+    source->vm.run(100000);
+
+    const int repetitions = 10000;
+    std::vector<uint8_t> state;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++)
+    {
+      source->vm.saveState(state);
+      if (!target->vm.loadState(state))
+      {
+        std::cout << workload.name << ": the save state was rejected\n";
+        return 1;
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    source->vm.run(100000);
+    target->vm.run(100000);
+    if (!sameState(*source, *target))
+    {
+      std::cout << workload.name << ": the loaded state runs differently\n";
+      return 1;
+    }
+
+    std::cout << std::left << std::setw(10) << workload.name << "save + load state " << std::fixed << std::setprecision(2) <<
+      std::chrono::duration<double, std::micro>(end - start).count() / repetitions << " us (" << state.size() <<
+      " bytes)\n";
+  }
+
+  return 0;
+}
@@ -1,3 +1,6 @@
+#ifndef DISASSEMBLER_DISASSEMBLE_INSTRUCTION_HPP
+#define DISASSEMBLER_DISASSEMBLE_INSTRUCTION_HPP
+
 #include <cstdint>
 #include <string>
 
@@ -58,7 +61,14 @@ std::string disassembleInstruction(uint8_t firstByte, uint8_t secondByte)
     }
   } else if (Opcode(firstByte >> 3) == Opcode::OpOnly)
   {
-    result += "iret";
+    switch (OnlyOpcode((((uint16_t)firstByte & 0x7) << 8) | (uint16_t)secondByte)) {
+      case OnlyOpcode::IRet:
+        result += "iret";
+        break;
+      case OnlyOpcode::Wait:
+        result += "wait";
+        break;
+    }
   }
 
   switch (opcodeTypes[firstByte >> 3])
@@ -125,3 +135,5 @@ std::string disassembleInstruction(uint8_t firstByte, uint8_t secondByte)
 
   return result;
 }
+
+#endif // DISASSEMBLER_DISASSEMBLE_INSTRUCTION_HPP
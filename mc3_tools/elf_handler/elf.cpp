@@ -392,7 +392,8 @@ bool ELF32::syncPointer(
 
 std::vector<uint8_t> getBinary(
   std::string filename,
-  std::map<uint16_t, SymbolData>* symbols)
+  std::map<uint16_t, SymbolData>* symbols,
+  std::vector<LoadedSegment>* segments)
 {
   std::filebuf inputFile;
   inputFile.open(filename, std::ios::in | std::ios::binary);
@@ -430,6 +431,15 @@ std::vector<uint8_t> getBinary(
           startPtr + pHeader->p_filesz,
           fileData.data() + pHeader->p_vaddr
         );
+
+        if (segments != nullptr)
+        {
+          segments->push_back({
+            .address = (uint16_t)pHeader->p_vaddr,
+            .size = (uint16_t)pHeader->p_memsz,
+            .writable = (pHeader->p_flags & PF_W) != 0,
+          });
+        }
       }
 
       if (symbols == nullptr)
@@ -106,8 +106,16 @@ struct SymbolData
   uint16_t size;
 };
 
+struct LoadedSegment
+{
+  uint16_t address;
+  uint16_t size;
+  bool writable;
+};
+
 std::vector<uint8_t> getBinary(
   std::string filename,
-  std::map<uint16_t, SymbolData>* symbols = nullptr);
+  std::map<uint16_t, SymbolData>* symbols = nullptr,
+  std::vector<LoadedSegment>* segments = nullptr);
 
 #endif // MC3_ELF_HANDLER_ELF_HPP
@@ -0,0 +1,226 @@
+#ifndef EMULATOR_BATCH_RUNNER_HPP
+#define EMULATOR_BATCH_RUNNER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "machine.hpp"
+#include "headless.hpp"
+#include "input_log.hpp"
+
+// Runs tasks 0 to count - 1 on a number of threads. Every thread starts with an
+// even share of the tasks and works through its own share from the back, and
+// once that is empty it takes tasks from the front of the other shares, so
+// threads that got short runs help out with the long ones
+class WorkStealingPool
+{
+  public:
+    static void run(size_t count, unsigned threads, const std::function<void(size_t)>& task)
+    {
+      threads = std::max(1u, std::min<unsigned>(threads, count));
+
+      std::vector<Queue> queues(threads);
+      for (size_t index = 0; index < count; index++)
+      {
+        queues[index % threads].tasks.push_back(index);
+      }
+
+      std::vector<std::thread> workers;
+      for (unsigned worker = 0; worker < threads; worker++)
+      {
+        workers.emplace_back([&, worker]()
+        {
+          size_t index;
+          while (take(queues, worker, index))
+          {
+            task(index);
+          }
+        });
+      }
+
+      for (std::thread& thread: workers)
+      {
+        thread.join();
+      }
+    }
+
+  private:
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<size_t> tasks;
+    };
+
+    static bool take(std::vector<Queue>& queues, unsigned worker, size_t& index)
+    {
+      {
+        std::lock_guard lock(queues[worker].mutex);
+        if (!queues[worker].tasks.empty())
+        {
+          index = queues[worker].tasks.back();
+          queues[worker].tasks.pop_back();
+          return true;
+        }
+      }
+
+      // Tasks are never added, so once every queue was seen empty there is nothing left
+      for (size_t offset = 1; offset < queues.size(); offset++)
+      {
+        Queue& victim = queues[(worker + offset) % queues.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+          index = victim.tasks.front();
+          victim.tasks.pop_front();
+          return true;
+        }
+      }
+
+      return false;
+    }
+};
+
+// One run of the program in a batch, on its own HDD image and optionally
+// replaying an input log
+struct BatchJob
+{
+  std::string hddImage;
+  std::string inputLog;
+};
+
+struct BatchResult
+{
+  int status = 1; // The exit status mc3emu would have for this run alone
+  uint64_t instructions = 0; // Executed by this run, without those before the save state
+  uint16_t pc = 0;
+  std::string ttyOutput;
+  std::string message; // Why the run ended
+  double seconds = 0;
+};
+
+// Part of memory made read only, or writable again, for --protect
+struct ProtectedRange
+{
+  uint16_t begin;
+  uint16_t end; // Inclusive
+  bool readOnly;
+};
+
+struct BatchOptions
+{
+  std::vector<uint8_t> state; // A save state every run starts from, none if empty
+  std::vector<ProtectedRange> protection; // Applied in order
+  VirtMachine::Features features = VirtMachine::Features::None;
+  bool useJit = false;
+  uint64_t maxInstructions = 0;
+  uint32_t hddBlocks = 2880;
+  bool decodeCacheEnabled = true;
+  bool fusionEnabled = true;
+  bool idleDetectionEnabled = true;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// Runs binary once per job, each on a Machine of its own
+std::vector<BatchResult> runBatch(const std::vector<uint8_t>& binary, const std::vector<BatchJob>& jobs,
+  const BatchOptions& options)
+{
+  std::vector<BatchResult> results(jobs.size());
+
+  WorkStealingPool::run(jobs.size(), options.threads, [&](size_t index)
+  {
+    const BatchJob& job = jobs[index];
+    BatchResult& result = results[index];
+    const auto start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<Machine> machine = std::make_unique<Machine>();
+    if (!machine->hdd.open(job.hddImage, options.hddBlocks))
+    {
+      result.message = "Could not open " + job.hddImage + "\n";
+      return;
+    }
+
+    std::ostringstream ttyOutput;
+    std::ostringstream message;
+    machine->tty.output = &ttyOutput;
+    machine->vm.decodeCacheEnabled = options.decodeCacheEnabled;
+    machine->vm.fusionEnabled = options.fusionEnabled;
+    machine->vm.idleDetectionEnabled = options.idleDetectionEnabled;
+    machine->load(binary);
+
+    if (!options.state.empty() && !machine->vm.loadState(options.state))
+    {
+      result.message = "Could not load the save state\n";
+      return;
+    }
+
+    for (const ProtectedRange& range: options.protection)
+    {
+      machine->vm.protectMemory(range.begin, range.end, range.readOnly);
+    }
+    machine->runFunction = VirtMachine::runFunction(options.features);
+    const uint64_t startInstructions = machine->vm.instructionCount;
+
+#ifdef MC3EMU_JIT
+    if (options.useJit && !machine->enableJit())
+    {
+      result.message = "Could not allocate memory for the JIT\n";
+      return;
+    }
+#endif
+
+    if (!job.inputLog.empty())
+    {
+      InputLog log;
+      if (!log.read(job.inputLog))
+      {
+        result.message = "Could not read an input log from " + job.inputLog + "\n";
+        return;
+      }
+      machine->replayInput(std::move(log));
+    }
+
+    result.status = runHeadless(machine->vm, options.maxInstructions, message,
+      [&](uint64_t count)
+      {
+        return machine->run(count);
+      },
+      [&]()
+      {
+        return machine->inputReplayer() && machine->inputReplayer()->pending();
+      });
+
+    const VirtMachine::IllegalWrite& illegalWrite = machine->vm.illegalWrite;
+    if (illegalWrite.occurred)
+    {
+      message << "Illegal write to " << illegalWrite.address << " by the instruction at " << illegalWrite.pc <<
+        " after " << machine->vm.instructionCount << " instructions\n";
+    }
+
+    if (machine->inputReplayer() && machine->inputReplayer()->diverged())
+    {
+      message << "The run diverged from the recorded input after " << machine->inputReplayer()->divergence() <<
+        " instructions\n";
+      result.status = 5;
+    }
+
+    result.instructions = machine->vm.instructionCount - startInstructions;
+    result.pc = machine->vm.pc;
+    machine->tty.flush();
+    result.ttyOutput = ttyOutput.str();
+    result.message = message.str();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  });
+
+  return results;
+}
+
+#endif // EMULATOR_BATCH_RUNNER_HPP
@@ -9,17 +9,21 @@
 #include <SFML/Graphics/Text.hpp>
 #include <SFML/Graphics/RectangleShape.hpp>
 #include <map>
+#include <memory>
 #include "gui-lib/include/gui.h"
 #include "../disassembler/disassemble_instruction.hpp"
 #include "../elf_handler/elf.hpp"
 #include "virt_machine.hpp"
+#include "rewind.hpp"
 #include "emu-utils/ram.hpp"
 
 class DebugWindow;
 
-extern VirtMachine vm;
-extern RAM<0xFF00> ram;
+extern VirtMachine& vm;
+extern RAM<0xFF00>& ram;
 extern DebugWindow debugWindow;
+extern std::unique_ptr<RewindHistory> rewindHistory;
+extern std::map<uint16_t, SymbolData> symbols;
 
 class DebugWindow
 {
@@ -36,8 +40,6 @@ class DebugWindow
 
     bool pause = false;
 
-    std::map<uint16_t, SymbolData> symbols;
-
     DebugWindow()
     {
       
@@ -377,7 +379,13 @@ class DebugWindow
               pause = !pause;
             } else if (pause && key->code == sf::Keyboard::Key::S)
             {
-              vm.tickClock();
+              runMachine(1);
+            } else if (pause && key->code == sf::Keyboard::Key::B && rewindHistory)
+            {
+              if (!rewindHistory->stepBack(sf::Keyboard::isKeyPressed(sf::Keyboard::Key::LShift) ? 1000 : 1))
+              {
+                std::clog << "The rewind history does not reach back that far\n";
+              }
             } else if (key->code == sf::Keyboard::Key::I)
             {
               vm.hardwareInterrupt(0xFF);
@@ -562,12 +570,13 @@ class DebugWindow
               winData += "pc:" + std::format("{:X}", vm.pc) + " ";
               winData += "iv:" + std::format("{:X}", vm.intVec) + "\n";
 
-              winData += "c:" + std::to_string(vm.flags.carry) + " ";
-              winData += "o:" + std::to_string(vm.flags.overflow) + " ";
-              winData += "z:" + std::to_string(vm.flags.zero) + " ";
-              winData += "s:" + std::to_string(vm.flags.sign) + " ";
+              VirtMachine::Flags flags = vm.getFlags();
+              winData += "c:" + std::to_string(flags.carry) + " ";
+              winData += "o:" + std::to_string(flags.overflow) + " ";
+              winData += "z:" + std::to_string(flags.zero) + " ";
+              winData += "s:" + std::to_string(flags.sign) + " ";
 
-              uint8_t bitsSet = vm.flags.bitsSet;
+              uint8_t bitsSet = flags.bitsSet;
               winData += "b:" + std::string(1, std::format("{:X}", bitsSet).back()) + "\n";
             
               winData += "IntBackup:\n";
@@ -0,0 +1,205 @@
+#ifndef EMULATOR_DMA_CONTROLLER_HPP
+#define EMULATOR_DMA_CONTROLLER_HPP
+
+#include <cstdint>
+
+#include "virt_machine.hpp"
+#include "io_device.hpp"
+#include "save_state.hpp"
+
+// Copies blocks of data on the host instead of one emulated instruction per
+// byte. Fourteen bytes, all little endian:
+//   0-3    source: a RAM address, or an HDD block for HddToRam
+//   4-7    destination: a RAM address, or a VRAM pixel index for RamToVga
+//   8-9    length in bytes
+//   10     mode, see Mode
+//   11     control: write Start to copy, reads Done or Error once it finished
+//   12-13  interrupt raised when a copy finishes, 0 for none
+// Copies finish before the storing instruction does. Devices are driven through
+// their own registers: HddToRam leaves the HDD at the last word it read and
+// RamToVga needs the VGA to be in pixel input mode. A copy that reaches outside
+// RAM or into memory protected with --protect changes nothing and ends in Error.
+// Every byte moved counts as a memory cycle of the VirtMachine timing model
+class DmaController: public IODevice
+{
+  public:
+    enum Mode: uint8_t
+    {
+      RamToRam = 0,
+      HddToRam = 1,
+      RamToVga = 2
+    };
+
+    enum Status: uint8_t
+    {
+      Idle = 0,
+      Done = 1,
+      Error = 2
+    };
+
+    static constexpr uint8_t Start = 1;
+
+    explicit DmaController(VirtMachine& vm): vm(vm) {}
+
+    uint8_t read(uint16_t address) override
+    {
+      if (address == 11)
+      {
+        return status;
+      }
+
+      return address < sizeof(registers) ? registers[address] : 0;
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      if (address == 11)
+      {
+        if (value == Start)
+        {
+          status = transfer() ? Done : Error;
+          if (get16(12) != 0)
+          {
+            vm.deviceInterrupt(get16(12));
+          }
+        }
+        return;
+      }
+
+      if (address < sizeof(registers))
+      {
+        registers[address] = value;
+      }
+    }
+
+    // Copies only reach devices through the I/O page, where VirtMachine decides
+    bool internalWrite(uint16_t address) const override
+    {
+      return true;
+    }
+
+    void saveState(StateWriter& state) const override
+    {
+      state.putBytes(registers, sizeof(registers));
+      state.put8(status);
+    }
+
+    bool loadState(StateReader& state) override
+    {
+      state.getBytes(registers, sizeof(registers));
+      status = state.get8();
+      return !state.failed && state.atEnd();
+    }
+
+  private:
+    VirtMachine& vm;
+    uint8_t registers[14] = {};
+    uint8_t status = Idle;
+
+    uint16_t get16(uint8_t offset) const
+    {
+      return registers[offset] | registers[offset + 1] << 8;
+    }
+
+    uint32_t get32(uint8_t offset) const
+    {
+      return get16(offset) | uint32_t(get16(offset + 2)) << 16;
+    }
+
+    // Every byte is mapped RAM, and writable unless read is set
+    bool isRam(uint32_t address, uint16_t length, bool read) const
+    {
+      for (uint32_t offset = 0; offset < length; offset++)
+      {
+        const uint32_t byte = address + offset;
+        if (byte > 0xFFFF || !vm.pages[byte >> 8].memory ||
+          (!read && (!vm.pages[byte >> 8].writable || vm.isReadOnly(byte))))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    bool transfer()
+    {
+      const uint32_t source = get32(0);
+      const uint32_t destination = get32(4);
+      const uint16_t length = get16(8);
+
+      switch (registers[10])
+      {
+        case RamToRam: {
+          if (!isRam(source, length, true) || !isRam(destination, length, false))
+          {
+            return false;
+          }
+
+          // Overlapping copies move the data like memmove
+          if (destination > source)
+          {
+            for (uint16_t offset = length; offset-- > 0;)
+            {
+              vm.write(destination + offset, vm.read(source + offset));
+            }
+          } else
+          {
+            for (uint16_t offset = 0; offset < length; offset++)
+            {
+              vm.write(destination + offset, vm.read(source + offset));
+            }
+          }
+          break;
+        } case HddToRam: {
+          if (!isRam(destination, length, false))
+          {
+            return false;
+          }
+
+          // 256 words per block, selected the way HDD_SELECTED_BLOCK and HDD_SELECTED_WORD do
+          for (uint32_t offset = 0; offset < length; offset += 2)
+          {
+            if (offset % 512 == 0)
+            {
+              const uint32_t block = source + offset / 512;
+              for (uint8_t byte = 0; byte < 4; byte++)
+              {
+                vm.write(0xFF00 + byte, block >> (byte * 8));
+              }
+            }
+
+            vm.write(0xFF04, offset % 512 / 2);
+            vm.write(destination + offset, vm.read(0xFF05));
+            const uint8_t high = vm.read(0xFF06);
+            if (offset + 1 < length)
+            {
+              vm.write(destination + offset + 1, high);
+            }
+          }
+          break;
+        } case RamToVga: {
+          if (!isRam(source, length, true))
+          {
+            return false;
+          }
+
+          for (uint16_t offset = 0; offset < length; offset++)
+          {
+            const uint32_t pixel = destination + offset;
+            vm.write(0xFF09, pixel);
+            vm.write(0xFF0A, pixel >> 8);
+            vm.write(0xFF0B, pixel >> 16);
+            vm.write(0xFF0C, vm.read(source + offset));
+          }
+          break;
+        } default:
+          return false;
+      }
+
+      vm.memoryCycles += length;
+      return true;
+    }
+};
+
+#endif // EMULATOR_DMA_CONTROLLER_HPP
@@ -1,9 +1,40 @@
 #include <iostream>
 #include <string>
-#include "debug_window.hpp"
+#include <vector>
+#include "virt_machine.hpp"
 
-extern DebugWindow debugWindow;
+extern VirtMachine& vm;
 extern std::string filename;
+extern bool debug;
+extern bool headless;
+extern uint64_t maxInstructions;
+extern std::string ttyOutputFilename;
+extern std::string ttyInputFilename;
+extern uint64_t ttyBufferSize;
+extern uint64_t ttyFlushInterval;
+extern std::string hddFilename;
+extern uint32_t hddBlocks;
+extern bool useJit;
+extern bool showFusionStats;
+extern std::string profileFilename;
+extern std::string profileStacksFilename;
+extern size_t traceLength;
+extern std::string traceFilename;
+extern bool traceBinary;
+extern bool writeProtection;
+extern std::vector<uint16_t> breakpoints;
+extern std::string loadStateFilename;
+extern std::string saveStateFilename;
+extern size_t rewindBudget;
+extern uint64_t rewindInterval;
+extern std::string recordInputFilename;
+extern std::string replayInputFilename;
+extern std::string batchFilename;
+extern std::string batchOutputDirectory;
+extern unsigned batchThreads;
+extern bool showStats;
+extern std::string statsStreamFilename;
+extern uint64_t statsInterval;
 
 void showHelp()
 {
@@ -14,9 +45,71 @@ Usage:
   mc3emu [options] <file>
 
 Options:
-  -h, --help     Show this help text
-  -d, --debug    Show debug window
-  -p, --protect  Protect memory regions and halt the processor if memory is illegaly written to
+  -h, --help                    Show this help text
+  -d, --debug                   Show debug window
+  -p, --protect                 Make the program's code read only and halt the processor, exiting with status 4,
+                                when it is written to. Variables and memory outside the program stay writable
+  -b, --break <address>         Stop before executing the instruction at address, pausing the debug window or
+                                printing the registers and continuing without it. Can be given more than once
+  --rewind <megabytes>          Keep up to this much history so the debug window can step backwards with B, or
+                                1000 instructions at a time with shift+B
+  --rewind-interval <count>     Instructions between two rewind checkpoints, stepping back re-executes up to this
+                                many instructions. 100000 by default
+  --record-input <file>         Write the interrupts the program receives and the values it reads from the keyboard,
+                                mouse, VGA and speaker to file on exit
+  --replay-input <file>         Run headless, raising the interrupts and answering the reads recorded with
+                                --record-input at the same points, so the run is identical to the recorded one
+  --batch <file>                Run the program headless once for every line of file, each naming an HDD image and
+                                optionally an input log to replay, spread over all cores. Prints the outcome of every
+                                run and exits with the highest of their exit statuses. Every run starts from
+                                --load-state and uses --protect and --jit if given
+  --batch-output <dir>          Write the TTY output of every batch run to <dir>/<run>.tty, numbering the runs
+                                from 0 in batch file order
+  --jobs <count>                Threads for --batch, all cores by default
+  --no-decode-cache             Decode every instruction when it is executed instead of caching decoded instructions
+  --no-fusion                   Execute the compiler's jump and stack access sequences one instruction at a time
+  --fusion-stats                Print how often each fused instruction sequence was executed on exit
+  --stats                       Count the instructions executed per operation, taken and not taken branches,
+                                interrupts and the accesses to every device, and print them as JSON to stderr on exit
+  --stats-stream <file>         Also write the counts as a line of JSON to file every --stats-interval while the
+                                program runs. unix:<path> connects to a Unix socket instead
+  --stats-interval <ms>         Milliseconds between two lines of --stats-stream, 1000 by default
+  --jit                         Translate the program to x86-64 code while it runs (x86-64 Linux only)
+  --no-idle-detection           Keep executing loops that cannot make progress instead of sleeping
+  --headless                    Run without opening any windows until the processor halts
+  --max-instructions <count>    Stop after executing this many instructions, exiting with status 2. With
+                                --load-state they are counted from the loaded state
+  --tty-output <file>           Write TTY output to a file or FIFO instead of stdout. Opening a FIFO waits for a
+                                reader
+  --tty-input <file>            Let the program read the contents of a file or FIFO from the TTY, - for stdin.
+                                Reads return 0 while no input is available
+  --tty-buffer <bytes>          Write TTY output at every newline or once this many bytes are waiting, 4096 by
+                                default. 1 writes every character at once
+  --tty-flush-interval <ms>     Write TTY output without a newline after waiting this long, 100 by default
+  --hdd <file>                  Use file as the HDD image, drive.img by default. It is created if it does not exist
+  --hdd-blocks <count>          Size of the HDD in 512 byte blocks, 2880 by default. Shorter images are extended
+                                with zeros
+  --profile <file>              Count how often every instruction is executed and write the hot spots
+                                per function, label and address to a file on exit
+  --profile-stacks <file>       Like --profile, but write the counts as function;label stacks for flame graph tools
+  --trace <count>               Remember the last <count> executed instructions and print them when the processor
+                                halts, or whenever the emulator receives SIGUSR1
+  --trace-file <file>           Write traces to a file instead of stderr
+  --trace-binary                Write traces to the trace file in binary instead of disassembled
+  --save-state <file>           Save the processor and memory to a file when the emulator exits. The HDD image and
+                                the devices on the bus (VGA, keyboard, mouse, speaker) are not included
+  --load-state <file>           Start from a state saved with --save-state instead of from reset. <file> is loaded
+                                first and still provides the symbols and the memory for --protect. A state saved
+                                in a window holds the VGA accelerator registers and only loads in a window
+
+Exit status:
+  0  The processor halted
+  1  The program could not be loaded
+  2  The instruction limit was reached
+  3  The program got stuck in an idle loop or waited for an interrupt while running headless, with no --tty-input
+     left to wait for
+  4  The program wrote to read only memory while running with --protect
+  5  The program read its input differently than in the run --replay-input replays
 
 Examples:
 
@@ -25,6 +118,33 @@ Examples:
 
   Start emulation with default configuration and input file loaded at 0x0000:
     mc3emu <file>
+
+  Run a program on a machine without a display, saving everything it prints:
+    mc3emu --headless --max-instructions 100000000 --tty-output log.txt <file>
+
+  Feed a program's TTY from another command and pass what it prints on:
+    producer | mc3emu --headless --tty-input - <file> | consumer
+
+  Find the hot spots of a program and draw them as a flame graph:
+    mc3emu --headless --profile hotspots.txt --profile-stacks stacks.txt <file>
+    flamegraph.pl stacks.txt > profile.svg
+
+  Run the boot phase of a program once, then start every later run after it:
+    mc3emu --headless --max-instructions 5000000 --save-state booted.mc3s <file>
+    mc3emu --headless --load-state booted.mc3s --max-instructions 1000000 <file>
+
+  Play a game once, then time exactly the same run again without a window:
+    mc3emu --record-input snake.input snake.elf
+    time mc3emu --replay-input snake.input snake.elf
+
+  Run a test program against every HDD image in a list on all cores:
+    mc3emu --batch images.txt --batch-output results --max-instructions 100000000 test.elf
+
+  Watch the instruction mix and device traffic of a running program:
+    mc3emu --stats-stream unix:/tmp/mc3stats.sock --stats-interval 500 <file>
+
+  Open the debugger when the program reaches address 0x1234:
+    mc3emu --debug --break 0x1234 <file>
 )";
 }
 
@@ -45,10 +165,103 @@ void handleArgs(int argc, char* argv[])
       showHelp();
     } else if (arg == "--debug" || arg == "-d")
     {
-      debugWindow.create();
+      debug = true;
     } else if (arg == "--protect" || arg == "-p")
     {
-
+      writeProtection = true;
+    } else if ((arg == "--break" || arg == "-b") && i+1 < argc)
+    {
+      breakpoints.push_back(std::stoul(argv[++i], nullptr, 0));
+    } else if (arg == "--rewind" && i+1 < argc)
+    {
+      rewindBudget = std::stoull(argv[++i]) << 20;
+    } else if (arg == "--rewind-interval" && i+1 < argc)
+    {
+      rewindInterval = std::stoull(argv[++i]);
+    } else if (arg == "--record-input" && i+1 < argc)
+    {
+      recordInputFilename = argv[++i];
+    } else if (arg == "--replay-input" && i+1 < argc)
+    {
+      replayInputFilename = argv[++i];
+    } else if (arg == "--batch" && i+1 < argc)
+    {
+      batchFilename = argv[++i];
+    } else if (arg == "--batch-output" && i+1 < argc)
+    {
+      batchOutputDirectory = argv[++i];
+    } else if (arg == "--jobs" && i+1 < argc)
+    {
+      batchThreads = std::stoul(argv[++i]);
+    } else if (arg == "--no-decode-cache")
+    {
+      vm.decodeCacheEnabled = false;
+    } else if (arg == "--no-fusion")
+    {
+      vm.fusionEnabled = false;
+    } else if (arg == "--fusion-stats")
+    {
+      showFusionStats = true;
+    } else if (arg == "--stats")
+    {
+      showStats = true;
+    } else if (arg == "--stats-stream" && i+1 < argc)
+    {
+      statsStreamFilename = argv[++i];
+    } else if (arg == "--stats-interval" && i+1 < argc)
+    {
+      statsInterval = std::stoull(argv[++i]);
+    } else if (arg == "--jit")
+    {
+      useJit = true;
+    } else if (arg == "--no-idle-detection")
+    {
+      vm.idleDetectionEnabled = false;
+    } else if (arg == "--headless")
+    {
+      headless = true;
+    } else if (arg == "--max-instructions" && i+1 < argc)
+    {
+      maxInstructions = std::stoull(argv[++i]);
+    } else if (arg == "--tty-output" && i+1 < argc)
+    {
+      ttyOutputFilename = argv[++i];
+    } else if (arg == "--tty-input" && i+1 < argc)
+    {
+      ttyInputFilename = argv[++i];
+    } else if (arg == "--tty-buffer" && i+1 < argc)
+    {
+      ttyBufferSize = std::stoull(argv[++i]);
+    } else if (arg == "--tty-flush-interval" && i+1 < argc)
+    {
+      ttyFlushInterval = std::stoull(argv[++i]);
+    } else if (arg == "--hdd" && i+1 < argc)
+    {
+      hddFilename = argv[++i];
+    } else if (arg == "--hdd-blocks" && i+1 < argc)
+    {
+      hddBlocks = std::stoul(argv[++i]);
+    } else if (arg == "--profile" && i+1 < argc)
+    {
+      profileFilename = argv[++i];
+    } else if (arg == "--profile-stacks" && i+1 < argc)
+    {
+      profileStacksFilename = argv[++i];
+    } else if (arg == "--trace" && i+1 < argc)
+    {
+      traceLength = std::stoull(argv[++i]);
+    } else if (arg == "--trace-file" && i+1 < argc)
+    {
+      traceFilename = argv[++i];
+    } else if (arg == "--save-state" && i+1 < argc)
+    {
+      saveStateFilename = argv[++i];
+    } else if (arg == "--load-state" && i+1 < argc)
+    {
+      loadStateFilename = argv[++i];
+    } else if (arg == "--trace-binary")
+    {
+      traceBinary = true;
     } else
     {
       filename = arg;
@@ -0,0 +1,64 @@
+#ifndef EMULATOR_HEADLESS_HPP
+#define EMULATOR_HEADLESS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+
+#include "virt_machine.hpp"
+
+// Runs without polling any windows or input devices until the processor halts,
+// or until maxInstructions have been executed if it is not zero. Nothing can
+// wake up a program stuck in an idle loop or waiting for an interrupt here, so
+// that also ends the run, unless inputPending() says a replayed input log is
+// going to. maxInstructions counts from where vm is now, which for a loaded save
+// state is not 0. runSlice(count) executes up to count instructions on vm.
+// Returns the exit status and writes why the run ended to log
+template <typename RunSlice, typename InputPending>
+int runHeadless(VirtMachine& vm, uint64_t maxInstructions, std::ostream& log, RunSlice runSlice,
+  InputPending inputPending)
+{
+  const uint64_t instructionsPerSlice = 1 << 20;
+  const uint64_t start = vm.instructionCount;
+
+  while (!vm.halted())
+  {
+    uint64_t slice = instructionsPerSlice;
+    if (maxInstructions != 0)
+    {
+      const uint64_t executed = vm.instructionCount - start;
+      if (executed >= maxInstructions)
+      {
+        log << "Instruction limit reached after " << vm.instructionCount << " instructions, pc = " << vm.pc << '\n';
+        return 2;
+      }
+
+      slice = std::min(slice, maxInstructions - executed);
+    }
+
+    runSlice(slice);
+
+    if (vm.idle() && !inputPending())
+    {
+      log << "Idle loop at pc = " << vm.pc << " after " << vm.instructionCount << " instructions\n";
+      return 3;
+    }
+
+    if (vm.waiting() && !inputPending())
+    {
+      log << "Waiting for an interrupt at pc = " << vm.pc << " after " << vm.instructionCount << " instructions\n";
+      return 3;
+    }
+  }
+
+  // Reported by the caller
+  if (vm.illegalWrite.occurred)
+  {
+    return 4;
+  }
+
+  log << "Halted after " << vm.instructionCount << " instructions\n";
+  return 0;
+}
+
+#endif // EMULATOR_HEADLESS_HPP
@@ -0,0 +1,237 @@
+#ifndef EMULATOR_INPUT_LOG_HPP
+#define EMULATOR_INPUT_LOG_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "virt_machine.hpp"
+#include "io_device.hpp"
+#include "save_state.hpp"
+
+// Everything that reaches the program from outside while it runs: the interrupts
+// raised by the host, at the instruction count they arrived at, and the values
+// read from the interactive devices (keyboard, mouse, VGA and speaker), in the
+// order they were read. Replaying both makes a run bit-identical to the recording
+struct InputLog
+{
+  using Read = VirtMachine::IORead;
+
+  std::vector<VirtMachine::InputEvent> interrupts;
+  std::vector<Read> reads;
+
+  static constexpr uint16_t version = 1;
+
+  // "MC3I", a 16-bit version, then a 32-bit count and the 64-bit instruction count
+  // and 16-bit id of every interrupt, then a 32-bit count and the address and
+  // value byte of every read
+  bool write(const std::string& filename) const
+  {
+    std::vector<uint8_t> data;
+    StateWriter out(data);
+    out.putBytes(reinterpret_cast<const uint8_t*>("MC3I"), 4);
+    out.put16(version);
+    out.put32(interrupts.size());
+    for (const VirtMachine::InputEvent& event: interrupts)
+    {
+      out.put64(event.instructionCount);
+      out.put16(event.interruptID);
+    }
+    out.put32(reads.size());
+    for (const Read& read: reads)
+    {
+      out.put8(read.address);
+      out.put8(read.value);
+    }
+
+    return writeStateFile(filename, data);
+  }
+
+  bool read(const std::string& filename)
+  {
+    const std::vector<uint8_t> data = readStateFile(filename);
+    StateReader in(data);
+    uint8_t magic[4] = {};
+    in.getBytes(magic, 4);
+    if (std::memcmp(magic, "MC3I", 4) != 0 || in.get16() != version)
+    {
+      return false;
+    }
+
+    interrupts.resize(in.get32());
+    for (VirtMachine::InputEvent& event: interrupts)
+    {
+      event.instructionCount = in.get64();
+      event.interruptID = in.get16();
+    }
+    reads.resize(in.get32());
+    for (Read& read: reads)
+    {
+      read.address = in.get8();
+      read.value = in.get8();
+    }
+
+    return !in.failed && in.atEnd();
+  }
+};
+
+// Connected from base to end in front of the devices on the bus, passes every
+// access through and logs the values read
+class InputRecorder: public IODevice
+{
+  public:
+    InputLog log;
+
+    InputRecorder(VirtMachine& vm, uint16_t base, uint16_t end): vm(vm), base(base), end(end)
+    {
+      vm.inputLog = &log.interrupts;
+    }
+
+    ~InputRecorder()
+    {
+      vm.inputLog = nullptr;
+    }
+
+    // Accesses from begin to end go to device instead of the bus
+    void forwardTo(IODevice* device, uint16_t begin, uint16_t end)
+    {
+      targets.push_back({device, begin, end});
+    }
+
+    uint8_t read(uint16_t address) override
+    {
+      const Target* target = targetOf(base + address);
+      const uint8_t value = target ? target->device->read(base + address - target->begin) : vm.bus.read(base + address);
+      log.reads.push_back({uint8_t(base + address), value});
+      return value;
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      if (const Target* target = targetOf(base + address))
+      {
+        target->device->write(base + address - target->begin, value);
+      } else
+      {
+        vm.bus.write(base + address, value);
+      }
+    }
+
+    // Whether reads from the I/O address with this low byte are logged
+    bool records(uint8_t address) const
+    {
+      return address >= (base & 0xFF) && address <= (end & 0xFF);
+    }
+
+  private:
+    VirtMachine& vm;
+    const uint16_t base;
+    const uint16_t end;
+
+    struct Target
+    {
+      IODevice* device;
+      uint16_t begin;
+      uint16_t end;
+    };
+
+    std::vector<Target> targets;
+
+    const Target* targetOf(uint16_t address) const
+    {
+      for (const Target& target: targets)
+      {
+        if (address >= target.begin && address <= target.end)
+        {
+          return &target;
+        }
+      }
+
+      return nullptr;
+    }
+};
+
+// Takes the place of the recorded devices, answering reads from the log and
+// raising the logged interrupts at the same instruction counts again
+class InputReplayer: public IODevice
+{
+  public:
+    InputReplayer(VirtMachine& vm, uint16_t base, InputLog log): vm(vm), base(base), log(std::move(log)) {}
+
+    // Raises the interrupts due now and returns how many instructions can be
+    // executed before the next one is due
+    uint64_t update()
+    {
+      while (nextInterrupt < log.interrupts.size() &&
+        log.interrupts[nextInterrupt].instructionCount <= vm.instructionCount)
+      {
+        vm.hardwareInterrupt(log.interrupts[nextInterrupt++].interruptID);
+      }
+
+      if (nextInterrupt == log.interrupts.size())
+      {
+        return std::numeric_limits<uint64_t>::max();
+      }
+
+      // Nothing executes until an interrupt arrives, so the recorded run was not waiting here
+      if (vm.waiting() && vm.intQueue.empty())
+      {
+        divergedAt = std::min(divergedAt, vm.instructionCount);
+        nextInterrupt = log.interrupts.size();
+        return std::numeric_limits<uint64_t>::max();
+      }
+
+      return log.interrupts[nextInterrupt].instructionCount - vm.instructionCount;
+    }
+
+    // True while there are interrupts left to raise
+    bool pending() const
+    {
+      return nextInterrupt < log.interrupts.size();
+    }
+
+    // Set once the program read a device at a different address than in the
+    // recording, or more often, so it no longer follows the recorded run
+    bool diverged() const
+    {
+      return divergedAt != noDivergence;
+    }
+
+    // Devices are read in the middle of run(), so this is the instruction count
+    // at the start of the run() call that diverged
+    uint64_t divergence() const
+    {
+      return divergedAt;
+    }
+
+    uint8_t read(uint16_t address) override
+    {
+      if (nextRead == log.reads.size() || log.reads[nextRead].address != uint8_t(base + address))
+      {
+        divergedAt = std::min(divergedAt, vm.instructionCount);
+        return 0;
+      }
+
+      return log.reads[nextRead++].value;
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+    }
+
+  private:
+    static constexpr uint64_t noDivergence = std::numeric_limits<uint64_t>::max();
+
+    VirtMachine& vm;
+    const uint16_t base;
+    const InputLog log;
+    size_t nextInterrupt = 0;
+    size_t nextRead = 0;
+    uint64_t divergedAt = noDivergence;
+};
+
+#endif // EMULATOR_INPUT_LOG_HPP
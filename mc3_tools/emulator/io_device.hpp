@@ -0,0 +1,38 @@
+#ifndef EMULATOR_IO_DEVICE_HPP
+#define EMULATOR_IO_DEVICE_HPP
+
+#include <cstdint>
+
+#include "save_state.hpp"
+
+// Devices implemented by the emulator itself and connected directly to the I/O page of a VirtMachine.
+// Addresses passed to read and write are relative to the first address the device is connected at.
+class IODevice
+{
+  public:
+    virtual ~IODevice() = default;
+
+    virtual uint8_t read(uint16_t address) = 0;
+
+    virtual void write(uint16_t address, uint8_t value) = 0;
+
+    // True if writing to address only changes the state saved below or the
+    // memory of the machine. Those writes are repeated when VirtMachine re-executes
+    // instructions from its I/O read log, all others reach outside the machine
+    // and are dropped then
+    virtual bool internalWrite(uint16_t address) const
+    {
+      return false;
+    }
+
+    // Devices with state of their own include it in save states through these.
+    // loadState returns false if the state cannot be restored
+    virtual void saveState(StateWriter& state) const {}
+
+    virtual bool loadState(StateReader& state)
+    {
+      return true;
+    }
+};
+
+#endif // EMULATOR_IO_DEVICE_HPP
@@ -0,0 +1,719 @@
+#ifndef EMULATOR_JIT_HPP
+#define EMULATOR_JIT_HPP
+
+#include "virt_machine.hpp"
+
+// Generated code uses the System V x86-64 calling convention
+#if defined(__x86_64__) && defined(__linux__)
+#define MC3EMU_JIT 1
+
+#include <sys/mman.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+
+// Translates basic blocks of MC3 code into x86-64 code. A block ends after a
+// jump, at the end of its 256 byte page, or before PutI, IRet and Wait, which
+// are left to the interpreter together with everything outside of memory
+// pages. Interrupts can only be delivered after one of those, so checking for
+// them between blocks matches run() exactly.
+//
+// While translated code runs rbx points to the VirtMachine, r12 to the block
+// table, r13 holds the instructions left in the budget and r14 the number of
+// instructions executed, counting the whole current block. instructionCount is
+// only updated when run() gets control back, helpers add the instructions
+// before theirs while they run so devices see the count run() would have
+class Jit
+{
+  public:
+    Jit(VirtMachine& vm): vm(vm)
+    {
+      void* memory = mmap(nullptr, codeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory != MAP_FAILED)
+      {
+        code = (uint8_t*)memory;
+        reset();
+      }
+    }
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    ~Jit()
+    {
+      if (code)
+      {
+        munmap(code, codeSize);
+      }
+    }
+
+    // False if no executable memory could be allocated, run() then only interprets
+    bool available() const
+    {
+      return code != nullptr;
+    }
+
+    uint64_t blocksTranslated = 0;
+
+    // Same contract as VirtMachine::run()
+    uint64_t run(uint64_t maxInstructions)
+    {
+      vm.inIdleLoop = false;
+
+      uint64_t executed = 0;
+      while (vm.running && executed < maxInstructions)
+      {
+        if (vm.translationsStale)
+        {
+          dropStaleBlocks();
+        }
+
+        // Translated code relies on lazy flags and cannot deliver interrupts
+        const void* block = nullptr;
+        if (code && !(vm.pc & 1) && vm.lazyFlags && !vm.waitingForInterrupt && !interruptPending())
+        {
+          block = blocks[vm.pc >> 1];
+          if (!block)
+          {
+            block = translate(vm.pc);
+          }
+        }
+
+        ExitState exit = {0, Exit::Done};
+        if (block)
+        {
+          exit = ((Entry)code)(&vm, blocks.data(), maxInstructions - executed, block);
+          executed += exit.executed;
+          vm.instructionCount += exit.executed;
+        }
+
+        // Not translatable, or the budget ran out before the block could run
+        if (exit.executed == 0)
+        {
+          uint64_t stepped = vm.run<VirtMachine::Dispatch::Switch>(1);
+          executed += stepped;
+          if (stepped == 0 || vm.inIdleLoop)
+          {
+            break;
+          }
+
+          continue;
+        }
+
+        if (exit.reason == Exit::IdleCheck && vm.idleDetectionEnabled && vm.idleLoopCompleted())
+        {
+          vm.inIdleLoop = true;
+          break;
+        }
+
+        // A device may have raised an interrupt during a store
+        if (interruptPending())
+        {
+          vm.handleInterrupt();
+        }
+      }
+
+      return executed;
+    }
+
+  private:
+    using DecodedInstruction = VirtMachine::DecodedInstruction;
+    using Operation = VirtMachine::Operation;
+
+    enum class Exit: uint64_t
+    {
+      Done,
+      IdleCheck // a short backward jump was counted and the idle check is due
+    };
+
+    struct ExitState
+    {
+      uint64_t executed;
+      Exit reason;
+    };
+
+    using Entry = ExitState (*)(VirtMachine* vm, const void* const* blocks, uint64_t budget, const void* block);
+
+    static constexpr size_t codeSize = 16 << 20;
+    static constexpr size_t maxBlockCodeSize = 16 << 10;
+    static constexpr uint16_t maxBlockLength = 64;
+
+    VirtMachine& vm;
+
+    uint8_t* code = nullptr;
+    uint8_t* codeEnd = nullptr;
+    uint8_t* exitStub = nullptr;
+
+    // Translated code for each instruction slot that starts a block
+    std::array<const void*, 0x8000> blocks{};
+
+    // Instructions that are executed by calling back into VirtMachine
+    std::deque<DecodedInstruction> helperInstructions;
+
+    bool interruptPending() const
+    {
+      return vm.intVec != 0 && !vm.inInterrupt && !vm.intQueue.empty();
+    }
+
+    // executed is the number of instructions run since run() last updated instructionCount
+    static void executeHelper(VirtMachine* vm, const DecodedInstruction* instr, uint64_t executed)
+    {
+      vm->instructionCount += executed;
+      vm->execute(*instr);
+      vm->instructionCount -= executed;
+    }
+
+    // Returns true if the block has to be left, because it overwrote translated
+    // code or a device raised an interrupt
+    static bool storeHelper(VirtMachine* vm, const DecodedInstruction* instr, uint64_t executed)
+    {
+      vm->instructionCount += executed;
+      vm->execute(*instr);
+      vm->instructionCount -= executed;
+
+      return vm->translationsStale || (vm->intVec != 0 && !vm->inInterrupt && !vm->intQueue.empty());
+    }
+
+    void reset()
+    {
+      codeEnd = code;
+      blocks.fill(nullptr);
+      helperInstructions.clear();
+      vm.translatedSlots.fill(0);
+      vm.staleTranslationPages.fill(false);
+      vm.translationsStale = false;
+
+      // Entry: save callee saved registers, which also aligns the stack for calls
+      emit({
+        0x53, // push rbx
+        0x41, 0x54, // push r12
+        0x41, 0x55, // push r13
+        0x41, 0x56, // push r14
+        0x41, 0x57, // push r15
+        0x48, 0x89, 0xFB, // mov rbx, rdi
+        0x49, 0x89, 0xF4, // mov r12, rsi
+        0x49, 0x89, 0xD5, // mov r13, rdx
+        0x45, 0x31, 0xF6, // xor r14d, r14d
+        0xFF, 0xE1 // jmp rcx
+      });
+
+      // Every block leaves through here with the exit reason in rdx
+      exitStub = codeEnd;
+      emit({
+        0x4C, 0x89, 0xF0, // mov rax, r14
+        0x41, 0x5F, // pop r15
+        0x41, 0x5E, // pop r14
+        0x41, 0x5D, // pop r13
+        0x41, 0x5C, // pop r12
+        0x5B, // pop rbx
+        0xC3 // ret
+      });
+    }
+
+    void dropStaleBlocks()
+    {
+      for (uint16_t page = 0; page < 256; page++)
+      {
+        if (vm.staleTranslationPages[page])
+        {
+          std::fill(blocks.begin() + page * 128, blocks.begin() + (page + 1) * 128, nullptr);
+          vm.translatedSlots[page * 2] = 0;
+          vm.translatedSlots[page * 2 + 1] = 0;
+          vm.staleTranslationPages[page] = false;
+        }
+      }
+
+      vm.translationsStale = false;
+    }
+
+    const void* translate(uint16_t start)
+    {
+      const VirtMachine::Page& page = vm.pages[start >> 8];
+      if ((start & 1) || !page.memory)
+      {
+        return nullptr;
+      }
+
+      DecodedInstruction instructions[maxBlockLength];
+      uint16_t length = 0;
+      bool endsWithJump = false;
+
+      uint16_t address = start;
+      do
+      {
+        const uint8_t* word = page.memory + (address & 0xFF);
+        DecodedInstruction instr = VirtMachine::decode(word[0], word[1]);
+        if (instr.operation == Operation::PutI || instr.operation == Operation::IRet || instr.operation == Operation::Wait)
+        {
+          break;
+        }
+
+        instructions[length++] = instr;
+        address += 2;
+
+        if (instr.operation >= Operation::JmpZ && instr.operation <= Operation::JmpNo)
+        {
+          endsWithJump = true;
+          break;
+        }
+      } while (length < maxBlockLength && (address & 0xFF) != 0);
+
+      if (length == 0)
+      {
+        return nullptr;
+      }
+
+      if (codeEnd + maxBlockCodeSize > code + codeSize)
+      {
+        reset();
+      }
+
+      uint8_t* block = codeEnd;
+
+      // Leave without executing anything if the budget cannot cover the whole block
+      emit({0x49, 0x81, 0xFD}); // cmp r13, length
+      emit32(length);
+      emit({0x73, 0x07}); // jae +7
+      emit({0x31, 0xD2}); // xor edx, edx
+      emitJump(exitStub);
+      emit({0x49, 0x81, 0xED}); // sub r13, length
+      emit32(length);
+      emit({0x49, 0x81, 0xC6}); // add r14, length
+      emit32(length);
+
+      const uint16_t last = length - 1;
+      for (uint16_t i = 0; i < length; i++)
+      {
+        const uint16_t instrAddress = start + i * 2;
+        if (i == last && endsWithJump)
+        {
+          translateJump(instructions[i], instrAddress);
+        } else
+        {
+          translateInstruction(instructions[i], instrAddress, length - i - 1);
+        }
+      }
+
+      if (!endsWithJump)
+      {
+        emitStaticExit(address);
+      }
+
+      for (uint16_t i = 0; i < length; i++)
+      {
+        const uint16_t slot = (start >> 1) + i;
+        vm.translatedSlots[slot >> 6] |= uint64_t(1) << (slot & 63);
+      }
+
+      blocks[start >> 1] = block;
+      blocksTranslated++;
+      return block;
+    }
+
+    // remaining is the number of instructions in the block after this one
+    void translateInstruction(const DecodedInstruction& instr, uint16_t address, uint16_t remaining)
+    {
+      switch (instr.operation)
+      {
+        case Operation::Undecoded:
+        case Operation::Nop:
+          break;
+        case Operation::OrVal:
+          loadReg(eax, instr.reg);
+          emitAluImm(1, eax, instr.value);
+          storeResult(instr.reg);
+          break;
+        case Operation::AndVal:
+          loadReg(eax, instr.reg);
+          emitAluImm(4, eax, instr.value);
+          storeResult(instr.reg);
+          break;
+        case Operation::XorVal:
+          loadReg(eax, instr.reg);
+          emitAluImm(6, eax, instr.value);
+          storeResult(instr.reg);
+          break;
+        case Operation::Not:
+          loadReg(eax, instr.reg);
+          emit({0xF7, 0xD0}); // not eax
+          storeResult(instr.reg);
+          break;
+        case Operation::SetVal:
+          emit({0xB8}); // mov eax, value
+          emit32(instr.value);
+          storeResult(instr.reg);
+          break;
+        case Operation::OrReg:
+        case Operation::AndReg:
+        case Operation::XorReg: {
+          const uint8_t opcode = instr.operation == Operation::OrReg ? 0x09 : instr.operation == Operation::AndReg ? 0x21 : 0x31;
+
+          loadReg(eax, instr.lhs);
+          loadRhs(instr);
+          emit({opcode, 0xC8}); // op eax, ecx
+          storeResult(instr.reg);
+          break;
+        } case Operation::AddVal:
+        case Operation::SubVal:
+          loadReg(eax, instr.reg);
+          emit({0xB9}); // mov ecx, value
+          emit32(instr.value);
+          translateAddSub(instr, instr.operation == Operation::SubVal);
+          break;
+        case Operation::AddReg:
+        case Operation::SubReg:
+          loadReg(eax, instr.lhs);
+          loadRhs(instr);
+          translateAddSub(instr, instr.operation == Operation::SubReg);
+          break;
+        case Operation::LshReg:
+        case Operation::RshReg:
+        case Operation::LrotReg:
+        case Operation::RrotReg:
+          if (instr.useValue)
+          {
+            translateShift(instr);
+          } else
+          {
+            // Shifting by a register has host dependent results for large amounts
+            emitHelperCall(instr, address, remaining, (const void*)&executeHelper);
+          }
+          break;
+        case Operation::GetF:
+        case Operation::LodB:
+        case Operation::LodW:
+          emitHelperCall(instr, address, remaining, (const void*)&executeHelper);
+          break;
+        case Operation::StrB:
+        case Operation::StrW: {
+          emitHelperCall(instr, address, remaining, (const void*)&storeHelper);
+
+          emit({0x84, 0xC0}); // test al, al
+          uint8_t* skip = emitBranch(0x84); // jz
+          if (remaining)
+          {
+            emit({0x49, 0x81, 0xC5}); // add r13, remaining
+            emit32(remaining);
+            emit({0x49, 0x81, 0xEE}); // sub r14, remaining
+            emit32(remaining);
+          }
+          storePc(address + 2);
+          emit({0x31, 0xD2}); // xor edx, edx
+          emitJump(exitStub);
+          patch(skip, codeEnd);
+          break;
+        } default:
+          emitHelperCall(instr, address, remaining, (const void*)&executeHelper);
+          break;
+      }
+    }
+
+    // Left in eax, right in ecx. The flag expressions mirror VirtMachine::execute,
+    // including the int promotions
+    void translateAddSub(const DecodedInstruction& instr, bool subtract)
+    {
+      if (instr.operation == Operation::AddVal)
+      {
+        // carry = uint16_t(left + right) < right
+        emit({0x8D, 0x14, 0x08}); // lea edx, [rax + rcx]
+        emit({0x0F, 0xB7, 0xD2}); // movzx edx, dx
+        emit({0x39, 0xCA}); // cmp edx, ecx
+        emitSetFlag(0x2, &vm.carry); // setb
+      } else if (instr.operation == Operation::AddReg)
+      {
+        // left + right < right is never true without the uint16_t cast
+        emitMem({0xC6}, 0, &vm.carry);
+        emit({0x00}); // mov byte [carry], 0
+      } else
+      {
+        // carry = int(left - right) > int(right)
+        emit({0x89, 0xC2}); // mov edx, eax
+        emit({0x29, 0xCA}); // sub edx, ecx
+        emit({0x39, 0xCA}); // cmp edx, ecx
+        emitSetFlag(0xF, &vm.carry); // setg
+      }
+
+      // overflow = (left >> 15 == right >> 15) != subtract && (left + right) >> 15 != left >> 15
+      emit({0x89, 0xC2}); // mov edx, eax
+      emit({0xC1, 0xEA, 0x0F}); // shr edx, 15
+      emit({0x89, 0xCE}); // mov esi, ecx
+      emit({0xC1, 0xEE, 0x0F}); // shr esi, 15
+      emit({0x39, 0xF2}); // cmp edx, esi
+      emit({0x41, 0x0F, uint8_t(subtract ? 0x95 : 0x94), 0xC0}); // setne/sete r8b
+      emit({0x8D, 0x34, 0x08}); // lea esi, [rax + rcx]
+      emit({0xC1, 0xEE, 0x0F}); // shr esi, 15
+      emit({0x39, 0xD6}); // cmp esi, edx
+      emit({0x41, 0x0F, 0x95, 0xC1}); // setne r9b
+      emit({0x45, 0x20, 0xC8}); // and r8b, r9b
+      emitMem({0x44, 0x88}, 0, &vm.overflow); // mov byte [overflow], r8b
+
+      emit({uint8_t(subtract ? 0x29 : 0x01), 0xC8}); // sub/add eax, ecx
+      storeResult(instr.reg);
+    }
+
+    void translateShift(const DecodedInstruction& instr)
+    {
+      const uint8_t amount = instr.value;
+
+      loadReg(eax, instr.lhs);
+
+      if (instr.operation == Operation::LshReg || instr.operation == Operation::LrotReg)
+      {
+        // carry = left >> (16 - amount), which is set when left >= 1 << (16 - amount)
+        if (amount == 0)
+        {
+          emitMem({0xC6}, 0, &vm.carry);
+          emit({0x00}); // mov byte [carry], 0
+        } else
+        {
+          emit({0x81, 0xF8}); // cmp eax, 1 << (16 - amount)
+          emit32(1 << (16 - amount));
+          emitSetFlag(0x3, &vm.carry); // setae
+        }
+      } else
+      {
+        // carry = left << (16 - amount), which fits in an int and is set when left != 0
+        emit({0x85, 0xC0}); // test eax, eax
+        emitSetFlag(0x5, &vm.carry); // setne
+      }
+
+      if (amount != 0)
+      {
+        switch (instr.operation)
+        {
+          case Operation::LshReg:
+            emit({0xC1, 0xE0, amount}); // shl eax, amount
+            break;
+          case Operation::RshReg:
+            emit({0xC1, 0xE8, amount}); // shr eax, amount
+            break;
+          case Operation::LrotReg:
+            emit({0x66, 0xC1, 0xC0, amount}); // rol ax, amount
+            break;
+          default:
+            emit({0x66, 0xC1, 0xC8, amount}); // ror ax, amount
+            break;
+        }
+      }
+
+      storeResult(instr.reg);
+    }
+
+    void translateJump(const DecodedInstruction& instr, uint16_t address)
+    {
+      // Condition codes of the branch that skips the jump
+      uint8_t notTaken = 0;
+      switch (instr.operation)
+      {
+        case Operation::JmpZ:
+        case Operation::JmpNz:
+          emitMem({0x66, 0x83}, 7, &vm.flagResult);
+          emit({0x00}); // cmp word [flagResult], 0
+          notTaken = instr.operation == Operation::JmpZ ? 0x5 : 0x4;
+          break;
+        case Operation::JmpS:
+        case Operation::JmpNs:
+          emitMem({0xF6}, 0, (const uint8_t*)&vm.flagResult + 1);
+          emit({0x80}); // test byte [flagResult + 1], 0x80
+          notTaken = instr.operation == Operation::JmpS ? 0x4 : 0x5;
+          break;
+        case Operation::JmpC:
+        case Operation::JmpNc:
+          emitMem({0x80}, 7, &vm.carry);
+          emit({0x00}); // cmp byte [carry], 0
+          notTaken = instr.operation == Operation::JmpC ? 0x4 : 0x5;
+          break;
+        default:
+          emitMem({0x80}, 7, &vm.overflow);
+          emit({0x00}); // cmp byte [overflow], 0
+          notTaken = instr.operation == Operation::JmpO ? 0x4 : 0x5;
+          break;
+      }
+
+      uint8_t* skip = emitBranch(0x80 | notTaken);
+
+      loadReg(eax, instr.reg);
+      emitAluImm(0, eax, instr.value); // add eax, value
+      emit({0x0F, 0xB7, 0xC0}); // movzx eax, ax
+      emitDynamicExit(address);
+
+      patch(skip, codeEnd);
+      emitStaticExit(address + 2);
+    }
+
+    // Continues with the block at target, or returns to run() if there is none yet
+    void emitStaticExit(uint16_t target)
+    {
+      storePc(target);
+
+      emit({0x49, 0x8B, 0x8C, 0x24}); // mov rcx, [r12 + slot * 8]
+      emit32(uint32_t(target >> 1) * sizeof(void*));
+      emitChain();
+    }
+
+    // The target is in eax. Counts short backward jumps the same way run() does
+    void emitDynamicExit(uint16_t jumpAddress)
+    {
+      emitMem({0x66, 0x89}, eax, &vm.pc); // mov word [pc], ax
+
+      emit({0xB9}); // mov ecx, jumpAddress
+      emit32(jumpAddress);
+      emit({0x29, 0xC1}); // sub ecx, eax
+      emit({0x0F, 0xB7, 0xC9}); // movzx ecx, cx
+      emit({0x83, 0xF9, uint8_t(VirtMachine::maxIdleLoopLength)}); // cmp ecx, maxIdleLoopLength
+      uint8_t* notBackward = emitBranch(0x87); // ja
+
+      emitMem({0xFF}, 0, &vm.backwardJumps); // inc dword [backwardJumps]
+      emitMem({0xF6}, 0, &vm.backwardJumps);
+      emit({uint8_t(VirtMachine::idleCheckInterval - 1)}); // test byte [backwardJumps], idleCheckInterval - 1
+      uint8_t* notDue = emitBranch(0x85); // jnz
+      emit({0xBA}); // mov edx, Exit::IdleCheck
+      emit32(uint32_t(Exit::IdleCheck));
+      emitJump(exitStub);
+
+      patch(notBackward, codeEnd);
+      patch(notDue, codeEnd);
+
+      // Odd addresses are never translated
+      emit({0xA8, 0x01}); // test al, 1
+      uint8_t* odd = emitBranch(0x85); // jnz
+      emit({0x49, 0x8B, 0x0C, 0x84}); // mov rcx, [r12 + rax * 4]
+      uint8_t* done = emitChain();
+      patch(odd, done);
+    }
+
+    // Jumps to the block in rcx, returns the address of the exit taken without one
+    uint8_t* emitChain()
+    {
+      emit({0x48, 0x85, 0xC9}); // test rcx, rcx
+      emit({0x74, 0x02}); // jz +2
+      emit({0xFF, 0xE1}); // jmp rcx
+
+      uint8_t* done = codeEnd;
+      emit({0x31, 0xD2}); // xor edx, edx
+      emitJump(exitStub);
+      return done;
+    }
+
+    // Calls function(vm, instr, executed) with pc already past the instruction,
+    // as in execute(). r14 already counts the remaining instructions of the
+    // block and this one, which run() would not have counted yet either
+    void emitHelperCall(const DecodedInstruction& instr, uint16_t address, uint16_t remaining, const void* function)
+    {
+      helperInstructions.push_back(instr);
+
+      storePc(address + 2);
+      emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+      emit({0x48, 0xBE}); // mov rsi, instr
+      emit64((uint64_t)&helperInstructions.back());
+      emit({0x49, 0x8D, 0x96}); // lea rdx, [r14 - remaining - 1]
+      emit32(uint32_t(-int32_t(remaining) - 1));
+      emit({0x48, 0xB8}); // mov rax, function
+      emit64((uint64_t)function);
+      emit({0xFF, 0xD0}); // call rax
+    }
+
+    static constexpr uint8_t eax = 0;
+    static constexpr uint8_t ecx = 1;
+
+    void loadReg(uint8_t hostReg, uint8_t reg)
+    {
+      emitMem({0x0F, 0xB7}, hostReg, &vm.regs[reg]); // movzx hostReg, word [regs + reg]
+    }
+
+    // ecx = the right operand of a Reg3 instruction
+    void loadRhs(const DecodedInstruction& instr)
+    {
+      if (instr.useValue)
+      {
+        emit({0xB9}); // mov ecx, value
+        emit32(instr.value);
+      } else
+      {
+        loadReg(ecx, instr.rhs);
+      }
+    }
+
+    // Stores ax into the register and flagResult, lazyFlags is already set
+    void storeResult(uint8_t reg)
+    {
+      emitMem({0x66, 0x89}, eax, &vm.regs[reg]);
+      emitMem({0x66, 0x89}, eax, &vm.flagResult);
+    }
+
+    void storePc(uint16_t value)
+    {
+      emitMem({0x66, 0xC7}, 0, &vm.pc);
+      emit({uint8_t(value & 0xFF), uint8_t(value >> 8)}); // mov word [pc], value
+    }
+
+    void emitSetFlag(uint8_t condition, const bool* flag)
+    {
+      emitMem({0x0F, uint8_t(0x90 | condition)}, 0, flag); // setcc byte [flag]
+    }
+
+    // 81 /digit with a 32-bit immediate
+    void emitAluImm(uint8_t digit, uint8_t hostReg, uint32_t value)
+    {
+      emit({0x81, uint8_t(0xC0 | (digit << 3) | hostReg)});
+      emit32(value);
+    }
+
+    // Addresses a VirtMachine member relative to rbx
+    void emitMem(std::initializer_list<uint8_t> opcode, uint8_t reg, const void* field)
+    {
+      emit(opcode);
+      emit({uint8_t(0x80 | (reg << 3) | 0x3)}); // [rbx + disp32]
+      emit32(uint32_t((const uint8_t*)field - (const uint8_t*)&vm));
+    }
+
+    // Conditional jump with a 32-bit displacement, returns the displacement to patch
+    uint8_t* emitBranch(uint8_t condition)
+    {
+      emit({0x0F, condition});
+      uint8_t* displacement = codeEnd;
+      emit32(0);
+      return displacement;
+    }
+
+    void emitJump(const uint8_t* target)
+    {
+      emit({0xE9});
+      uint8_t* displacement = codeEnd;
+      emit32(0);
+      patch(displacement, target);
+    }
+
+    void patch(uint8_t* displacement, const uint8_t* target)
+    {
+      const int32_t offset = int32_t(target - (displacement + 4));
+      std::memcpy(displacement, &offset, sizeof(offset));
+    }
+
+    void emit(std::initializer_list<uint8_t> bytes)
+    {
+      for (uint8_t byte: bytes)
+      {
+        *codeEnd++ = byte;
+      }
+    }
+
+    void emit32(uint32_t value)
+    {
+      std::memcpy(codeEnd, &value, sizeof(value));
+      codeEnd += sizeof(value);
+    }
+
+    void emit64(uint64_t value)
+    {
+      std::memcpy(codeEnd, &value, sizeof(value));
+      codeEnd += sizeof(value);
+    }
+};
+
+#endif
+
+#endif // EMULATOR_JIT_HPP
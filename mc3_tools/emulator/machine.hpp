@@ -0,0 +1,116 @@
+#ifndef EMULATOR_MACHINE_HPP
+#define EMULATOR_MACHINE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "emu-utils/bus.hpp"
+#include "emu-utils/ram.hpp"
+
+#include "virt_machine.hpp"
+#include "mapped_hdd.hpp"
+#include "stream_tty.hpp"
+#include "perf_counter.hpp"
+#include "dma_controller.hpp"
+#include "vga_accelerator.hpp"
+#include "input_log.hpp"
+#include "jit.hpp"
+
+// A complete MC3 computer without a display: the processor, RAM, the HDD, the
+// TTY, the performance counter, the DMA controller and the blitter registers.
+// mc3emu puts a VgaAccelerator using them in front of its VGA. Nothing is
+// shared between instances, so any number of them can run on different threads
+// as long as they use different HDD images. The HDD has no image until
+// hdd.open() is called. The windowed devices are added by mc3emu itself
+class Machine
+{
+  public:
+    VirtMachine vm;
+    RAM<0xFF00> ram;
+    MappedHDD hdd;
+    StreamTTY tty;
+    PerfCounter perfCounter;
+    DmaController dma;
+    Blitter blitter;
+
+    // The run() instantiation run() uses unless the JIT is enabled
+    VirtMachine::RunFunction runFunction = VirtMachine::runFunction(VirtMachine::Features::None);
+
+    Machine(): perfCounter(vm), dma(vm)
+    {
+      // RAM is accessed directly through the page table, only the I/O page uses the bus
+      vm.mapMemory(0x0000, 0xFEFF, ram.memory);
+      vm.connectDevice(&hdd, 0xFF00, 0xFF06);
+      vm.connectDevice(&tty, 0xFF07, 0xFF07);
+      vm.connectDevice(&perfCounter, 0xFF17, 0xFF1F);
+      vm.connectDevice(&dma, 0xFF20, 0xFF2D);
+      vm.connectDevice(&blitter, 0xFF2E, 0xFF3F);
+    }
+
+    Machine(const Machine&) = delete;
+    Machine& operator=(const Machine&) = delete;
+
+    void load(const std::vector<uint8_t>& binary)
+    {
+      std::copy(binary.begin(), binary.begin() + std::min<size_t>(binary.size(), sizeof(ram.memory)), ram.memory);
+      vm.invalidateDecodeCache();
+    }
+
+    // Takes the place of the windowed devices from 0xFF08 to 0xFF16, see InputReplayer
+    void replayInput(InputLog log)
+    {
+      replayer = std::make_unique<InputReplayer>(vm, 0xFF08, std::move(log));
+      vm.connectDevice(replayer.get(), 0xFF08, 0xFF16);
+    }
+
+    InputReplayer* inputReplayer()
+    {
+      return replayer.get();
+    }
+
+#ifdef MC3EMU_JIT
+    // Runs through the JIT from now on. Returns false, changing nothing, if
+    // there is no memory to translate into
+    bool enableJit()
+    {
+      jit = std::make_unique<Jit>(vm);
+      if (!jit->available())
+      {
+        jit.reset();
+        return false;
+      }
+
+      return true;
+    }
+#endif
+
+    // Like VirtMachine::run, raising replayed interrupts when they are due
+    uint64_t run(uint64_t maxInstructions)
+    {
+      if (replayer)
+      {
+        maxInstructions = std::min(maxInstructions, replayer->update());
+      }
+
+#ifdef MC3EMU_JIT
+      if (jit)
+      {
+        return jit->run(maxInstructions);
+      }
+#endif
+
+      return (vm.*runFunction)(maxInstructions);
+    }
+
+  private:
+    std::unique_ptr<InputReplayer> replayer;
+#ifdef MC3EMU_JIT
+    std::unique_ptr<Jit> jit;
+#endif
+};
+
+#endif // EMULATOR_MACHINE_HPP
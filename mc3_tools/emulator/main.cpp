@@ -1,32 +1,168 @@
+#ifndef MC3EMU_HEADLESS
 #include <SFML/Graphics.hpp>
 #include <SFML/Audio.hpp>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "emu-utils/bus.hpp"
 #include "emu-utils/ram.hpp"
 #include "emu-utils/rom.hpp"
 
-#include "emu-utils/hdd.hpp"
-#include "emu-utils/tty.hpp"
+#ifndef MC3EMU_HEADLESS
 #include "emu-utils/vga.hpp"
 #include "emu-utils/keyboard.hpp"
 #include "emu-utils/mouse.hpp"
 #include "emu-utils/speaker.hpp"
+#endif
 
 #include "virt_machine.hpp"
+#include "machine.hpp"
+#include "batch_runner.hpp"
+#include "jit.hpp"
+#include "stream_tty.hpp"
+#include "trace_buffer.hpp"
+#include "save_state.hpp"
+#include "rewind.hpp"
+#include "input_log.hpp"
+#include "vga_accelerator.hpp"
+#include "render_thread.hpp"
+#include "stats.hpp"
 
-VirtMachine vm;
-RAM<0xFF00> ram;
-HDD hdd("drive.img", 2880);
-TTY tty;
-VGA vga;
-Keyboard keyboard;
-Mouse mouse;
-Speaker speaker;
+Machine machine;
+VirtMachine& vm = machine.vm;
+RAM<0xFF00>& ram = machine.ram;
+
+#ifndef MC3EMU_HEADLESS
+// Only created when running with a window
+std::unique_ptr<RenderThread> vga; // Owns the VGA
+std::unique_ptr<VgaAccelerator> vgaAccelerator;
+std::unique_ptr<Keyboard> keyboard;
+std::unique_ptr<Mouse> mouse;
+std::unique_ptr<Speaker> speaker;
+#endif
 
 std::string filename;
+bool debug = false;
+#ifdef MC3EMU_HEADLESS
+bool headless = true;
+#else
+bool headless = false;
+#endif
+uint64_t maxInstructions = 0;
+std::string ttyOutputFilename;
+std::string ttyInputFilename;
+uint64_t ttyBufferSize = 4096;
+uint64_t ttyFlushInterval = 100;
+std::string hddFilename = "drive.img";
+uint32_t hddBlocks = 2880;
+bool useJit = false;
+bool showFusionStats = false;
+std::string profileFilename;
+std::string profileStacksFilename;
+size_t traceLength = 0;
+std::string traceFilename;
+bool traceBinary = false;
+bool writeProtection = false;
+std::vector<uint16_t> breakpoints;
+std::string loadStateFilename;
+std::string saveStateFilename;
+size_t rewindBudget = 0;
+uint64_t rewindInterval = 100000;
+std::string recordInputFilename;
+std::string replayInputFilename;
+std::string batchFilename;
+std::string batchOutputDirectory;
+unsigned batchThreads = 0;
+bool showStats = false;
+std::string statsStreamFilename;
+uint64_t statsInterval = 1000;
+
+// The run() instantiation with exactly the features the command line asks for
+VirtMachine::RunFunction runFunction = VirtMachine::runFunction(VirtMachine::Features::None);
+
+#ifdef MC3EMU_JIT
+std::unique_ptr<Jit> jit;
+#endif
+
+std::unique_ptr<InputRecorder> inputRecorder;
+std::unique_ptr<RewindHistory> rewindHistory; // Uses inputRecorder
+std::unique_ptr<InputReplayer> inputReplayer;
+std::unique_ptr<StatsStream> statsStream;
+std::unique_ptr<TraceBuffer> traceBuffer;
+std::ofstream traceFile;
+volatile std::sig_atomic_t traceDumpRequested = 0;
+
+// Writes the trace to the trace file, or as text to stderr if there is none
+void dumpTrace(const std::string& reason)
+{
+  std::ostream& out = traceFile.is_open() ? traceFile : std::clog;
+  if (traceBinary && traceFile.is_open())
+  {
+    traceBuffer->writeBinary(out);
+  } else
+  {
+    out << reason << " at pc = " << vm.pc << " after " << vm.instructionCount << " instructions\n";
+    traceBuffer->writeText(out);
+  }
+  out.flush();
+}
+
+// Runs the machine through the JIT when it is enabled
+uint64_t runMachine(uint64_t maxInstructions)
+{
+  // Requested with SIGUSR1, checked here so the trace is never dumped mid-instruction
+  if (traceDumpRequested)
+  {
+    traceDumpRequested = 0;
+    dumpTrace("Trace requested");
+  }
+
+  if (inputReplayer)
+  {
+    maxInstructions = std::min(maxInstructions, inputReplayer->update());
+  }
+
+  if (rewindHistory)
+  {
+    rewindHistory->update();
+  }
+
+  if (statsStream)
+  {
+    statsStream->update();
+  }
+
+  machine.tty.update();
+
+#ifdef MC3EMU_JIT
+  if (jit)
+  {
+    return jit->run(maxInstructions);
+  }
+#endif
+
+  const uint64_t executed = (vm.*runFunction)(maxInstructions);
+  if (vm.atBreakpoint())
+  {
+    std::clog << "Breakpoint at pc = " << vm.pc << " after " << vm.instructionCount << " instructions, registers:";
+    for (uint16_t reg: vm.regs)
+    {
+      std::clog << ' ' << reg;
+    }
+    std::clog << '\n';
+  }
+
+  return executed;
+}
 
 #include <sys/ioctl.h>
 
@@ -35,11 +171,226 @@ std::string filename;
 #include "../elf_handler/elf.hpp"
 #include "../elf_handler/elf.cpp"
 
+std::map<uint16_t, SymbolData> symbols;
+
+#include "profiler.hpp"
+
+// Loaded code is read only. The assembler puts the whole program into one
+// segment that is writable, so in writable segments only what comes before the
+// static_data label is protected. Variables are always writable, so their
+// ranges come after the read only ones
+std::vector<ProtectedRange> programProtection(const std::vector<LoadedSegment>& segments)
+{
+  std::vector<ProtectedRange> ranges;
+  for (const LoadedSegment& segment: segments)
+  {
+    if (segment.size == 0)
+    {
+      continue;
+    }
+
+    uint32_t end = segment.address + segment.size;
+    if (segment.writable)
+    {
+      for (const auto& [address, symbol]: symbols)
+      {
+        if (symbol.name == "static_data" && address >= segment.address && address < end)
+        {
+          end = address;
+        }
+      }
+    }
+
+    if (end > segment.address)
+    {
+      ranges.push_back({segment.address, uint16_t(end - 1), true});
+    }
+  }
+
+  for (const auto& [address, symbol]: symbols)
+  {
+    if (symbol.type == SymbolData::Variable && symbol.size != 0)
+    {
+      ranges.push_back({address, uint16_t(std::min<uint32_t>(address + symbol.size - 1, 0xFFFF)), false});
+    }
+  }
+
+  return ranges;
+}
+
+std::unique_ptr<Profiler> profiler;
+
+#include "headless.hpp"
+
+// Only asked while the program is idle or waiting, so this also waits a little
+// for TTY input instead of spinning
+bool inputPending()
+{
+  if (machine.tty.inputOpen())
+  {
+    machine.tty.waitForInput(std::chrono::milliseconds(1));
+    return true;
+  }
+
+  return inputReplayer && inputReplayer->pending();
+}
+
+// Both files are written when the emulator exits
+bool writeProfile()
+{
+  if (!profileFilename.empty())
+  {
+    std::ofstream file(profileFilename);
+    profiler->writeReport(file, vm);
+    if (!file)
+    {
+      std::cout << "Could not write " << profileFilename << '\n';
+      return false;
+    }
+  }
+
+  if (!profileStacksFilename.empty())
+  {
+    std::ofstream file(profileStacksFilename);
+    profiler->writeCollapsedStacks(file);
+    if (!file)
+    {
+      std::cout << "Could not write " << profileStacksFilename << '\n';
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// instructions is how many this process executed, the fusion stats are not saved
+void printFusionStats(uint64_t instructions)
+{
+  const VirtMachine::FusionStats& stats = vm.fusionStats;
+  const uint64_t total = std::max<uint64_t>(instructions, 1);
+
+  std::clog << "Fused sequences:\n" <<
+    "  far jumps       " << stats.farJumps << '\n' <<
+    "  stack accesses  " << stats.stackAccesses << '\n' <<
+    "  cut short       " << stats.bailouts << '\n' <<
+    "  " << stats.fusedInstructions << " of " << instructions << " instructions (" <<
+    stats.fusedInstructions * 100 / total << "%) executed as part of a fused sequence\n";
+}
+
+// Runs the program once for every line of the batch file, which names an HDD
+// image and optionally an input log to replay, and returns the highest exit
+// status. Every run starts from --load-state and is protected and translated
+// like a single run would be
+int runBatchFile(const std::vector<uint8_t>& binary, const std::vector<ProtectedRange>& protection)
+{
+  // These write one report for the whole process
+  if (!profileFilename.empty() || !profileStacksFilename.empty() || traceLength != 0 || !breakpoints.empty() ||
+    showStats || !statsStreamFilename.empty())
+  {
+    std::cout << "--profile, --profile-stacks, --trace, --break, --stats and --stats-stream are not available with "
+      "--batch\n";
+    return 1;
+  }
+
+  std::ifstream file(batchFilename);
+  if (!file)
+  {
+    std::cout << "Could not open " << batchFilename << '\n';
+    return 1;
+  }
+
+  std::vector<BatchJob> jobs;
+  std::string line;
+  while (std::getline(file, line))
+  {
+    std::istringstream fields(line);
+    BatchJob job;
+    if (fields >> job.hddImage)
+    {
+      fields >> job.inputLog;
+      jobs.push_back(job);
+    }
+  }
+
+  BatchOptions options;
+  if (!loadStateFilename.empty())
+  {
+    options.state = readStateFile(loadStateFilename);
+    if (!vm.loadState(options.state))
+    {
+      std::cout << "Could not load a save state from " << loadStateFilename << '\n';
+      return 1;
+    }
+  }
+
+  options.protection = protection;
+  options.features = writeProtection ? VirtMachine::Features::Protect : VirtMachine::Features::None;
+  options.useJit = useJit;
+  if (writeProtection && useJit)
+  {
+    std::cout << "Translated code is not write protected, falling back to the interpreter\n";
+    options.useJit = false;
+  }
+#ifndef MC3EMU_JIT
+  if (options.useJit)
+  {
+    std::cout << "The JIT is only available on x86-64 Linux, falling back to the interpreter\n";
+    options.useJit = false;
+  }
+#endif
+
+  options.maxInstructions = maxInstructions;
+  options.hddBlocks = hddBlocks;
+  options.decodeCacheEnabled = vm.decodeCacheEnabled;
+  options.fusionEnabled = vm.fusionEnabled;
+  options.idleDetectionEnabled = vm.idleDetectionEnabled;
+  if (batchThreads != 0)
+  {
+    options.threads = batchThreads;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<BatchResult> results = runBatch(binary, jobs, options);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int status = 0;
+  uint64_t instructions = 0;
+  for (size_t index = 0; index < results.size(); index++)
+  {
+    const BatchResult& result = results[index];
+    std::cout << index << "  " << result.status << "  " << jobs[index].hddImage << "  " << result.message;
+    if (result.message.empty() || result.message.back() != '\n')
+    {
+      std::cout << '\n';
+    }
+
+    if (!batchOutputDirectory.empty())
+    {
+      std::ofstream output(batchOutputDirectory + "/" + std::to_string(index) + ".tty", std::ios::binary);
+      output << result.ttyOutput;
+      if (!output)
+      {
+        std::cout << "Could not write the TTY output of run " << index << " to " << batchOutputDirectory << '\n';
+        status = std::max(status, 1);
+      }
+    }
+
+    status = std::max(status, result.status);
+    instructions += result.instructions;
+  }
+
+  std::cout << results.size() << " runs, " << instructions << " instructions in " << seconds << " seconds (" <<
+    uint64_t(instructions / std::max(seconds, 1e-9) / 1000000) << " MIPS)\n";
+  return status;
+}
+
+#ifndef MC3EMU_HEADLESS
 #include "clock.hpp"
 
 #include "debug_window.hpp"
 
 DebugWindow debugWindow;
+#endif
 /*
 Memory layout
 
@@ -52,30 +403,45 @@ With no particular size: Boot code, Data
   Keyboard - 2 bytes
   Mouse - 4 bytes
   Speaker - 3 bytes
+  Performance counter - 9 bytes
+  DMA - 14 bytes
+  Blitter - 18 bytes
 */
 
-int main(int argc, char *argv[])
+#ifndef MC3EMU_HEADLESS
+int runWindowed()
 {
-  handleArgs(argc, argv);
-
   Clock vSyncClock;
 
-  vm.bus.connect(&ram, 0x0000, 0xFEFF);
-  vm.bus.connect(&hdd, 0xFF00, 0xFF06);
-  vm.bus.connect(&tty, 0xFF07, 0xFF07);
-  vm.bus.connect(&vga, 0xFF08, 0xFF0D);
-  vm.bus.connect(&keyboard, 0xFF0E, 0xFF0F);
-  vm.bus.connect(&mouse, 0xFF10, 0xFF13);
-  vm.bus.connect(&speaker, 0xFF14, 0xFF16);
+  vga = RenderThread::create<VGA>();
+  keyboard = std::make_unique<Keyboard>();
+  mouse = std::make_unique<Mouse>();
+  speaker = std::make_unique<Speaker>();
 
-  if (filename.empty())
+  vm.bus.connect(keyboard.get(), 0xFF0E, 0xFF0F);
+  vm.bus.connect(mouse.get(), 0xFF10, 0xFF13);
+  vm.bus.connect(speaker.get(), 0xFF14, 0xFF16);
+
+  // The VGA is reached through the recorder if there is one, and the accelerator
+  // is in front of both, so the recorder only sees what reaches the VGA
+  IODevice* vgaInput = vga.get();
+  if (inputRecorder)
   {
-    std::cout << "No input file specified.\n";
-    return 1;
+    inputRecorder->forwardTo(vga.get(), 0xFF08, 0xFF0D);
+    vm.connectDevice(inputRecorder.get(), 0xFF08, 0xFF16);
+    vgaInput = inputRecorder.get();
+  }
+
+  vgaAccelerator = std::make_unique<VgaAccelerator>(vm, machine.blitter, vgaInput);
+  vm.connectDevice(vgaAccelerator.get(), 0xFF08, 0xFF0D);
+
+  if (debug)
+  {
+    debugWindow.create();
   }
 
-  std::vector<uint8_t> binary = getBinary(filename, &debugWindow.symbols);
-  std::copy(binary.begin(), binary.end(), ram.memory);
+  // Clock, input and debugger polling happens once per slice rather than once per instruction
+  const uint64_t instructionsPerSlice = 10000;
 
   bool running = true;
   while (running)
@@ -93,36 +459,322 @@ int main(int argc, char *argv[])
       break;
     }
 
+    // Drawing happens on the render thread
     if (newFrame)
     {
-      vga.update();
+      vga->present();
     }
 
     // sends interrupt 0x60 when a key event occurs.
-    if (keyboard.update())
+    if (keyboard->update())
     {
       vm.hardwareInterrupt(0x60);
     }
 
-    mouse.update();
+    mouse->update();
 
     if (!debugWindow.CPUpaused())
     {
-      running = vm.tickClock();
+      runMachine(instructionsPerSlice);
+      running = !vm.halted();
+
+      if (debug && vm.atBreakpoint())
+      {
+        debugWindow.pause = true;
+      }
+    }
+
+    // Nothing changes until the next input poll, so give the host core back
+    if (vm.idle() || vm.waiting())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 
     if (newFrame)
     {
       debugWindow.update();
     }
+  }
 
-    /*if (std::memcmp(ram.memory, program.data(), 0xF1) != 0)
+  return 0;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  handleArgs(argc, argv);
+
+  std::ofstream ttyOutputFile;
+  if (!ttyOutputFilename.empty())
+  {
+    ttyOutputFile.open(ttyOutputFilename, std::ios::binary);
+    if (!ttyOutputFile)
     {
-      std::cerr << "invalid memory write\n";
-      debugWindow.pause = true;
-    }*/
-    //std::cout << '\r' << ((uint16_t)ram.memory[0x0011] | ((uint16_t)ram.memory[0x0012] << 8)) << std::flush;
+      std::cout << "Could not open " << ttyOutputFilename << '\n';
+      return 1;
+    }
+    machine.tty.output = &ttyOutputFile;
   }
 
-  return 0;
+  if (!ttyInputFilename.empty() && !machine.tty.openInput(ttyInputFilename))
+  {
+    std::cout << "Could not open " << ttyInputFilename << '\n';
+    return 1;
+  }
+  machine.tty.bufferSize = ttyBufferSize;
+  machine.tty.flushInterval = std::chrono::milliseconds(ttyFlushInterval);
+
+  if (filename.empty())
+  {
+    std::cout << "No input file specified.\n";
+    return 1;
+  }
+
+  std::vector<LoadedSegment> segments;
+  std::vector<uint8_t> binary = getBinary(filename, &symbols, &segments);
+  if (binary.empty())
+  {
+    std::cout << "Could not load " << filename << '\n';
+    return 1;
+  }
+  machine.load(binary);
+
+  std::vector<ProtectedRange> protection;
+  if (writeProtection)
+  {
+    if (segments.empty())
+    {
+      std::cout << filename << " has no program headers, no memory is protected\n";
+    }
+    protection = programProtection(segments);
+  }
+
+  if (!batchFilename.empty())
+  {
+    return runBatchFile(binary, protection);
+  }
+
+  if (!machine.hdd.open(hddFilename, hddBlocks))
+  {
+    std::cout << "Could not open " << hddFilename << '\n';
+    return 1;
+  }
+
+  for (const ProtectedRange& range: protection)
+  {
+    vm.protectMemory(range.begin, range.end, range.readOnly);
+  }
+
+  if (!loadStateFilename.empty() && !vm.loadState(readStateFile(loadStateFilename)))
+  {
+    std::cout << "Could not load a save state from " << loadStateFilename << '\n';
+    return 1;
+  }
+
+  // The interactive devices from 0xFF08 to 0xFF16 only exist in windowed runs, the
+  // recorder sits in front of them there and the replayer takes their place
+  if (!recordInputFilename.empty())
+  {
+    inputRecorder = std::make_unique<InputRecorder>(vm, 0xFF08, 0xFF16);
+  }
+
+  // Replaying runs headless, where nothing can step back
+  if (rewindBudget != 0 && !replayInputFilename.empty())
+  {
+    std::cout << "Rewinding is not available while replaying input\n";
+    rewindBudget = 0;
+  }
+
+  // Stepping back keeps the recording in step
+  if (rewindBudget != 0)
+  {
+    rewindHistory = std::make_unique<RewindHistory>(vm, rewindBudget, rewindInterval, inputRecorder.get());
+  }
+
+  if (!replayInputFilename.empty())
+  {
+    InputLog log;
+    if (!log.read(replayInputFilename))
+    {
+      std::cout << "Could not read an input log from " << replayInputFilename << '\n';
+      return 1;
+    }
+
+    inputReplayer = std::make_unique<InputReplayer>(vm, 0xFF08, std::move(log));
+    vm.connectDevice(inputReplayer.get(), 0xFF08, 0xFF16);
+    headless = true;
+  }
+
+  if (!profileFilename.empty() || !profileStacksFilename.empty())
+  {
+    profiler = std::make_unique<Profiler>(symbols);
+    vm.executionCounts = profiler->counts.data();
+
+    if (useJit)
+    {
+      std::cout << "Translated code is not profiled, falling back to the interpreter\n";
+      useJit = false;
+    }
+  }
+
+  if (traceLength != 0)
+  {
+    traceBuffer = std::make_unique<TraceBuffer>(traceLength);
+    vm.trace = traceBuffer.get();
+
+    if (!traceFilename.empty())
+    {
+      traceFile.open(traceFilename, std::ios::binary);
+      if (!traceFile)
+      {
+        std::cout << "Could not open " << traceFilename << '\n';
+        return 1;
+      }
+    }
+
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, [](int)
+    {
+      traceDumpRequested = 1;
+    });
+#endif
+
+    if (useJit)
+    {
+      std::cout << "Translated code is not traced, falling back to the interpreter\n";
+      useJit = false;
+    }
+  }
+
+  if (writeProtection && useJit)
+  {
+    std::cout << "Translated code is not write protected, falling back to the interpreter\n";
+    useJit = false;
+  }
+
+  for (uint16_t address: breakpoints)
+  {
+    vm.setBreakpoint(address);
+  }
+
+  if (!breakpoints.empty() && useJit)
+  {
+    std::cout << "Translated code does not stop at breakpoints, falling back to the interpreter\n";
+    useJit = false;
+  }
+
+  if (!statsStreamFilename.empty())
+  {
+    statsStream = std::make_unique<StatsStream>(vm, statsStreamFilename, std::chrono::milliseconds(statsInterval));
+    if (!statsStream->good())
+    {
+      std::cout << "Could not open " << statsStreamFilename << '\n';
+      return 1;
+    }
+  }
+
+  const bool stats = showStats || statsStream;
+  if (stats && useJit)
+  {
+    std::cout << "Translated code does not count statistics, falling back to the interpreter\n";
+    useJit = false;
+  }
+
+  using Features = VirtMachine::Features;
+  runFunction = VirtMachine::runFunction(
+    (profiler ? Features::Profile : Features::None) |
+    (traceBuffer ? Features::Trace : Features::None) |
+    (writeProtection ? Features::Protect : Features::None) |
+    (breakpoints.empty() ? Features::None : Features::Breakpoints) |
+    (stats ? Features::Stats : Features::None));
+
+  // A loaded save state starts with the instructions executed before it
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t startInstructions = vm.instructionCount;
+
+  if (useJit)
+  {
+#ifdef MC3EMU_JIT
+    jit = std::make_unique<Jit>(vm);
+    if (!jit->available())
+    {
+      std::cout << "Could not allocate memory for the JIT, falling back to the interpreter\n";
+      jit.reset();
+    }
+#else
+    std::cout << "The JIT is only available on x86-64 Linux, falling back to the interpreter\n";
+#endif
+  }
+
+#ifndef MC3EMU_HEADLESS
+  int status = headless ? runHeadless(vm, maxInstructions, std::clog, runMachine, inputPending) : runWindowed();
+#else
+  int status = runHeadless(vm, maxInstructions, std::clog, runMachine, inputPending);
+#endif
+
+  // Output without a final newline may still be waiting, ttyOutputFile closes on return
+  machine.tty.flush();
+
+  if (vm.illegalWrite.occurred)
+  {
+    std::clog << "Illegal write to " << vm.illegalWrite.address << " by the instruction at " << vm.illegalWrite.pc <<
+      " after " << vm.instructionCount << " instructions\n";
+    status = 4;
+  }
+
+  if (inputRecorder && !inputRecorder->log.write(recordInputFilename))
+  {
+    std::cout << "Could not write " << recordInputFilename << '\n';
+    return 1;
+  }
+
+  if (inputReplayer && inputReplayer->diverged())
+  {
+    std::clog << "The run diverged from the recorded input after " << inputReplayer->divergence() << " instructions\n";
+    status = 5;
+  }
+
+  if (!saveStateFilename.empty())
+  {
+    std::vector<uint8_t> state;
+    vm.saveState(state);
+    if (!writeStateFile(saveStateFilename, state))
+    {
+      std::cout << "Could not write " << saveStateFilename << '\n';
+      return 1;
+    }
+  }
+
+  if (showFusionStats)
+  {
+    printFusionStats(vm.instructionCount - startInstructions);
+  }
+
+  if (stats)
+  {
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (showStats)
+    {
+      writeStatsJson(std::clog, vm, vm.instructionCount - startInstructions, seconds);
+    }
+    if (statsStream)
+    {
+      statsStream->write();
+    }
+  }
+
+  if (traceBuffer && vm.illegalWrite.occurred)
+  {
+    dumpTrace("Illegal write");
+  } else if (traceBuffer && vm.halted())
+  {
+    dumpTrace("Halted");
+  }
+
+  if (profiler && !writeProfile())
+  {
+    return 1;
+  }
+
+  return status;
 }
@@ -0,0 +1,184 @@
+#ifndef EMULATOR_MAPPED_HDD_HPP
+#define EMULATOR_MAPPED_HDD_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "io_device.hpp"
+#include "save_state.hpp"
+
+// The HDD with its image mapped into memory, so word accesses are plain memory
+// accesses and the host page cache does the caching and write-back. Seven bytes,
+// like emu-utils' HDD:
+//   0-3  selected block, 512 bytes each
+//   4    selected word in the block
+//   5-6  the selected word, little endian
+// Selecting a block asks the host to read the next one ahead, so sequential
+// reads do not wait for the disk
+class MappedHDD: public IODevice
+{
+  public:
+    static constexpr uint32_t blockSize = 512;
+
+    MappedHDD() = default;
+
+    MappedHDD(const MappedHDD&) = delete;
+    MappedHDD& operator=(const MappedHDD&) = delete;
+
+    ~MappedHDD()
+    {
+      close();
+    }
+
+    // Maps blocks blocks of filename, creating it or growing it with zeros if it
+    // is shorter. Returns false if that fails, the HDD then has no blocks
+    bool open(const std::string& filename, uint32_t blocks)
+    {
+      close();
+
+      const int file = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+      if (file < 0)
+      {
+        return false;
+      }
+
+      const size_t size = size_t(blocks) * blockSize;
+      struct stat status;
+      void* mapping = MAP_FAILED;
+      if (size != 0 && fstat(file, &status) == 0 && (size_t(status.st_size) >= size || ftruncate(file, size) == 0))
+      {
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+      }
+      ::close(file);
+
+      if (mapping == MAP_FAILED)
+      {
+        return false;
+      }
+
+      data = static_cast<uint8_t*>(mapping);
+      blockCount = blocks;
+      prefetchedPage = noPage;
+      return true;
+    }
+
+    // Writes changed blocks back to the image, the host also does on its own
+    void flush()
+    {
+      if (data)
+      {
+        msync(data, size_t(blockCount) * blockSize, MS_SYNC);
+      }
+    }
+
+    void close()
+    {
+      if (data)
+      {
+        flush();
+        munmap(data, size_t(blockCount) * blockSize);
+        data = nullptr;
+        blockCount = 0;
+      }
+    }
+
+    uint32_t blocks() const
+    {
+      return blockCount;
+    }
+
+    uint8_t read(uint16_t address) override
+    {
+      if (address < 4)
+      {
+        return selectedBlock >> (address * 8);
+      } else if (address == 4)
+      {
+        return selectedWord;
+      }
+
+      // Blocks past the end of the image read as zeros
+      const uint8_t* byte = selectedByte(address - 5);
+      return byte ? *byte : 0;
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      if (address < 4)
+      {
+        const uint32_t shift = address * 8;
+        selectedBlock = (selectedBlock & ~(uint32_t(0xFF) << shift)) | (uint32_t(value) << shift);
+        prefetch(selectedBlock + 1);
+      } else if (address == 4)
+      {
+        selectedWord = value;
+      } else if (uint8_t* byte = selectedByte(address - 5))
+      {
+        *byte = value;
+      }
+    }
+
+    // Selecting a word stays inside the machine, writing it changes the image
+    bool internalWrite(uint16_t address) const override
+    {
+      return address < 5;
+    }
+
+    // The image is not part of save states, only which word is selected
+    void saveState(StateWriter& state) const override
+    {
+      state.put32(selectedBlock);
+      state.put8(selectedWord);
+    }
+
+    bool loadState(StateReader& state) override
+    {
+      selectedBlock = state.get32();
+      selectedWord = state.get8();
+      return !state.failed && state.atEnd();
+    }
+
+  private:
+    static constexpr size_t noPage = SIZE_MAX;
+
+    uint8_t* data = nullptr;
+    uint32_t blockCount = 0;
+    uint32_t selectedBlock = 0;
+    uint8_t selectedWord = 0;
+    size_t prefetchedPage = noPage;
+
+    uint8_t* selectedByte(uint8_t high) const
+    {
+      if (selectedBlock >= blockCount)
+      {
+        return nullptr;
+      }
+
+      return data + size_t(selectedBlock) * blockSize + selectedWord * 2 + high;
+    }
+
+    // Host pages hold several blocks, each is only requested once in a row
+    void prefetch(uint32_t block)
+    {
+      static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+      if (block >= blockCount)
+      {
+        return;
+      }
+
+      const size_t page = size_t(block) * blockSize / pageSize;
+      if (page != prefetchedPage)
+      {
+        prefetchedPage = page;
+        madvise(data + page * pageSize, pageSize, MADV_WILLNEED);
+      }
+    }
+};
+
+#endif // EMULATOR_MAPPED_HDD_HPP
@@ -0,0 +1,101 @@
+#ifndef EMULATOR_PERF_COUNTER_HPP
+#define EMULATOR_PERF_COUNTER_HPP
+
+#include <cstdint>
+
+#include "virt_machine.hpp"
+#include "io_device.hpp"
+#include "save_state.hpp"
+
+// Lets programs time themselves in retired instructions and in cycles of the
+// VirtMachine timing model. Nine bytes:
+//   0    control: write start, stop or sample, reads 1 while started
+//   1-4  32-bit instruction count latched by the last stop or sample
+//   5-8  32-bit cycle count latched by the last stop or sample
+// stop latches the counts since start, sample the counts since the machine was
+// created. The latched values only change on the next command, so multi-byte
+// reads are consistent. The accessing instruction itself is not included
+class PerfCounter: public IODevice
+{
+  public:
+    enum Command: uint8_t
+    {
+      Start = 1,
+      Stop = 2,
+      Sample = 3
+    };
+
+    explicit PerfCounter(const VirtMachine& vm): vm(vm) {}
+
+    uint8_t read(uint16_t address) override
+    {
+      if (address == 0)
+      {
+        return started;
+      }
+
+      const uint32_t value = address < 5 ? latchedInstructions : latchedCycles;
+      return value >> ((address - 1) % 4 * 8);
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      if (address != 0)
+      {
+        return;
+      }
+
+      switch (value)
+      {
+        case Start:
+          startInstructions = vm.instructionCount;
+          startCycles = vm.cycles();
+          started = true;
+          break;
+        case Stop:
+          // Without a start this counts from zero, like sample
+          latchedInstructions = vm.instructionCount - startInstructions;
+          latchedCycles = vm.cycles() - startCycles;
+          started = false;
+          break;
+        case Sample:
+          latchedInstructions = vm.instructionCount;
+          latchedCycles = vm.cycles();
+          break;
+      }
+    }
+
+    bool internalWrite(uint16_t address) const override
+    {
+      return true;
+    }
+
+    void saveState(StateWriter& state) const override
+    {
+      state.put64(startInstructions);
+      state.put64(startCycles);
+      state.put32(latchedInstructions);
+      state.put32(latchedCycles);
+      state.put8(started);
+    }
+
+    bool loadState(StateReader& state) override
+    {
+      startInstructions = state.get64();
+      startCycles = state.get64();
+      latchedInstructions = state.get32();
+      latchedCycles = state.get32();
+      started = state.get8();
+      return !state.failed && state.atEnd();
+    }
+
+  private:
+    const VirtMachine& vm;
+    uint64_t startInstructions = 0;
+    uint64_t startCycles = 0;
+    uint32_t latchedInstructions = 0;
+    uint32_t latchedCycles = 0;
+    bool started = false;
+};
+
+#endif // EMULATOR_PERF_COUNTER_HPP
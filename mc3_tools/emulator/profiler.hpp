@@ -0,0 +1,195 @@
+#ifndef EMULATOR_PROFILER_HPP
+#define EMULATOR_PROFILER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "virt_machine.hpp"
+#include "../elf_handler/elf.hpp"
+#include "../disassembler/disassemble_instruction.hpp"
+
+// Counts every executed instruction by address and attributes the counts to
+// the labels in the program's symbol table
+class Profiler
+{
+  public:
+    // Indexed by pc >> 1, VirtMachine::executionCounts points here while profiling
+    std::array<uint64_t, 0x8000> counts{};
+
+    Profiler(const std::map<uint16_t, SymbolData>& symbols): symbols(symbols) {}
+
+    // Instructions are attributed to the closest label before them, and labels to
+    // the closest function label before them. The labels the compiler generates for
+    // loops, conditions and return addresses are not functions
+    static bool isFunctionLabel(const std::string& name)
+    {
+      return name.find("_ReturnAddress") == std::string::npos && !name.starts_with("lbl_loop_") &&
+        !name.starts_with("lbl_if_");
+    }
+
+    void writeReport(std::ostream& out, VirtMachine& vm, size_t hottestAddresses = 20) const
+    {
+      const uint64_t total = std::max<uint64_t>(totalCount(), 1);
+
+      std::map<std::string, uint64_t> functions;
+      std::map<std::string, uint64_t> labels;
+      std::vector<std::pair<uint64_t, uint16_t>> addresses;
+      for (uint32_t slot = 0; slot < counts.size(); slot++)
+      {
+        if (counts[slot] == 0)
+        {
+          continue;
+        }
+
+        const Location location = locate(slot << 1);
+        functions[location.function] += counts[slot];
+        labels[location.label] += counts[slot];
+        addresses.emplace_back(counts[slot], slot << 1);
+      }
+
+      out << "Instructions executed: " << totalCount() << "\n\n";
+
+      auto writeSorted = [&](const std::string& title, const std::map<std::string, uint64_t>& entries)
+      {
+        std::vector<std::pair<uint64_t, std::string>> sorted;
+        for (const auto& [name, count]: entries)
+        {
+          sorted.emplace_back(count, name);
+        }
+        std::sort(sorted.begin(), sorted.end(), std::greater<>());
+
+        out << title << ":\n";
+        for (const auto& [count, name]: sorted)
+        {
+          writeCount(out, count, total);
+          out << name << '\n';
+        }
+        out << '\n';
+      };
+
+      writeSorted("Functions", functions);
+      writeSorted("Labels", labels);
+
+      std::sort(addresses.begin(), addresses.end(), std::greater<>());
+      addresses.resize(std::min(addresses.size(), hottestAddresses));
+
+      out << "Hottest instructions:\n";
+      for (const auto& [count, address]: addresses)
+      {
+        writeCount(out, count, total);
+
+        const Location location = locate(address);
+        std::string name = location.label;
+        if (location.labelFound)
+        {
+          name += "+" + std::to_string(address - location.labelAddress);
+        }
+
+        std::ostringstream hex;
+        hex << "0x" << std::hex << std::setw(4) << std::setfill('0') << address;
+        out << hex.str() << "  " << std::left << std::setw(24) << std::setfill(' ') << name << std::right;
+
+        // Reading the I/O page could have side effects
+        if (vm.pages[address >> 8].memory)
+        {
+          out << "  " << disassembleInstruction(vm.read(address), vm.read(address + 1));
+        }
+        out << '\n';
+      }
+    }
+
+    // One "function;label count" line per label, the format flamegraph.pl and
+    // similar tools read
+    void writeCollapsedStacks(std::ostream& out) const
+    {
+      std::map<std::string, uint64_t> stacks;
+      for (uint32_t slot = 0; slot < counts.size(); slot++)
+      {
+        if (counts[slot] == 0)
+        {
+          continue;
+        }
+
+        const Location location = locate(slot << 1);
+        if (location.function == location.label)
+        {
+          stacks[location.function] += counts[slot];
+        } else
+        {
+          stacks[location.function + ";" + location.label] += counts[slot];
+        }
+      }
+
+      for (const auto& [stack, count]: stacks)
+      {
+        out << stack << ' ' << count << '\n';
+      }
+    }
+
+  private:
+    const std::map<uint16_t, SymbolData>& symbols;
+
+    struct Location
+    {
+      std::string function = "[unknown]";
+      std::string label = "[unknown]";
+      uint16_t labelAddress = 0;
+      bool labelFound = false;
+    };
+
+    Location locate(uint16_t address) const
+    {
+      Location location;
+
+      for (auto symbol = symbols.upper_bound(address); symbol != symbols.begin();)
+      {
+        --symbol;
+        if (symbol->second.type != SymbolData::Label)
+        {
+          continue;
+        }
+
+        if (!location.labelFound)
+        {
+          location.labelFound = true;
+          location.label = symbol->second.name;
+          location.labelAddress = symbol->first;
+        }
+
+        if (isFunctionLabel(symbol->second.name))
+        {
+          location.function = symbol->second.name;
+          break;
+        }
+      }
+
+      return location;
+    }
+
+    uint64_t totalCount() const
+    {
+      uint64_t total = 0;
+      for (uint64_t count: counts)
+      {
+        total += count;
+      }
+
+      return total;
+    }
+
+    static void writeCount(std::ostream& out, uint64_t count, uint64_t total)
+    {
+      out << std::fixed << std::setprecision(2) << std::setw(7) << count * 100.0 / total << "%  " <<
+        std::setw(12) << count << "  ";
+    }
+};
+
+#endif // EMULATOR_PROFILER_HPP
@@ -0,0 +1,211 @@
+#ifndef EMULATOR_RENDER_THREAD_HPP
+#define EMULATOR_RENDER_THREAD_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "io_device.hpp"
+
+// Creates, feeds and updates a display device on a thread of its own, so
+// uploading and drawing frames never holds up the program. The emulation thread
+// only appends the program's writes to a buffer and hands it over with
+// present() once per frame. Three buffers take turns: the one being filled, the
+// one handed over and the one being drawn from. If the render thread is still
+// drawing when the next frame is presented, the new writes are added to the
+// handed over buffer and the frame is dropped instead of waiting. Only when
+// more than maxPendingWrites are waiting does present() wait for the render
+// thread to take them. Writes that repeat the value a pointer or size register
+// already holds are left out.
+// Programs only ever write the VGA, so reads are answered on the emulation
+// thread with the value last written to the register
+class RenderThread: public IODevice
+{
+  public:
+    template <typename Display>
+    static std::unique_ptr<RenderThread> create()
+    {
+      // Display is only ever touched on the render thread, windows included
+      struct Adapter: Target
+      {
+        std::unique_ptr<Display> display = std::make_unique<Display>();
+
+        void write(uint16_t address, uint8_t value) override
+        {
+          display->write(address, value);
+        }
+
+        void update() override
+        {
+          display->update();
+        }
+      };
+
+      return std::unique_ptr<RenderThread>(new RenderThread([]() -> std::unique_ptr<Target>
+      {
+        return std::make_unique<Adapter>();
+      }));
+    }
+
+    ~RenderThread()
+    {
+      {
+        std::lock_guard lock(mutex);
+        stopping = true;
+      }
+      changed.notify_all();
+      thread.join();
+    }
+
+    RenderThread(const RenderThread&) = delete;
+    RenderThread& operator=(const RenderThread&) = delete;
+
+    // Writes pending on the render thread before present() waits for it, 8 MB
+    static constexpr size_t maxPendingWrites = size_t(1) << 22;
+
+    uint8_t read(uint16_t address) override
+    {
+      return registers[uint8_t(address)];
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      // 1 to 3 are the pointer bytes in pixel input mode and the screen size
+      // otherwise, plain stores until the next command changes the mode
+      if (address == 0)
+      {
+        known = 0;
+      } else if (address <= 3)
+      {
+        if (known >> address & 1 && registers[address] == value)
+        {
+          return;
+        }
+        known |= 1 << address;
+      }
+
+      registers[uint8_t(address)] = value;
+      filling.push_back({uint8_t(address), value});
+    }
+
+    // Call at every vsync, only waits for the render thread if it is more than
+    // maxPendingWrites behind
+    void present()
+    {
+      {
+        std::unique_lock lock(mutex);
+        if (handedOver.size() + filling.size() > maxPendingWrites)
+        {
+          taken.wait(lock, [&]()
+          {
+            return handedOver.empty();
+          });
+        }
+
+        handOver();
+        if (frameRequested)
+        {
+          dropped++;
+        }
+        frameRequested = true;
+      }
+      changed.notify_all();
+    }
+
+    // Frames presented while the previous one was still being drawn
+    uint64_t droppedFrames() const
+    {
+      std::lock_guard lock(mutex);
+      return dropped;
+    }
+
+  private:
+    struct Target
+    {
+      virtual ~Target() = default;
+      virtual void write(uint16_t address, uint8_t value) = 0;
+      virtual void update() = 0;
+    };
+
+    struct Write
+    {
+      uint8_t address;
+      uint8_t value;
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::condition_variable taken;
+
+    uint8_t registers[256] = {}; // As the program last wrote them
+    uint8_t known = 0; // Bit n is set while the VGA holds registers[n], for 1 to 3
+    std::vector<Write> filling;
+    std::vector<Write> handedOver; // Guarded by mutex, like everything below
+    bool frameRequested = false;
+    bool stopping = false;
+    uint64_t dropped = 0;
+
+    std::thread thread;
+
+    template <typename Create>
+    explicit RenderThread(Create create): thread([this, create]()
+    {
+      render(create());
+    })
+    {
+    }
+
+    // With mutex held
+    void handOver()
+    {
+      if (handedOver.empty())
+      {
+        handedOver.swap(filling);
+      } else
+      {
+        handedOver.insert(handedOver.end(), filling.begin(), filling.end());
+        filling.clear();
+      }
+    }
+
+    void render(std::unique_ptr<Target> target)
+    {
+      std::vector<Write> drawing;
+
+      std::unique_lock lock(mutex);
+      while (true)
+      {
+        changed.wait(lock, [&]()
+        {
+          return stopping || frameRequested;
+        });
+        if (stopping)
+        {
+          break;
+        }
+
+        drawing.swap(handedOver);
+        frameRequested = false;
+        lock.unlock();
+        taken.notify_all();
+
+        for (const Write& write: drawing)
+        {
+          target->write(write.address, write.value);
+        }
+        drawing.clear();
+
+        target->update();
+
+        lock.lock();
+      }
+
+      lock.unlock();
+      target.reset();
+    }
+};
+
+#endif // EMULATOR_RENDER_THREAD_HPP
@@ -0,0 +1,302 @@
+#ifndef EMULATOR_REWIND_HPP
+#define EMULATOR_REWIND_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "virt_machine.hpp"
+#include "save_state.hpp"
+#include "input_log.hpp"
+
+// Lets the machine step backwards. A checkpoint of the processor and of the
+// devices connected with connectDevice is taken every checkpointInterval
+// instructions, and memory is kept as an undo log: each checkpoint holds the
+// pages that were written before the next one, as they were when it was taken.
+// Interrupts and the values read from the I/O page are logged as well. Stepping
+// back restores the closest checkpoint before the target and executes forward to
+// it again, re-injecting the logged interrupts at the instruction counts they
+// originally arrived at and answering reads from the log, so the program sees
+// what it saw the first time. Only writes that stay inside the machine are
+// repeated, see IODevice::internalWrite: nothing is printed or read from the
+// host again. What already left the machine, like the HDD image and the screen
+// the VGA accelerator draws on, keeps its later contents.
+// With a recorder, its log is cut back and refilled so it matches the run as it
+// continues after stepping back
+class RewindHistory
+{
+  public:
+    RewindHistory(VirtMachine& vm, size_t memoryBudget, uint64_t checkpointInterval,
+      InputRecorder* recorder = nullptr):
+      vm(vm), memoryBudget(memoryBudget), checkpointInterval(std::max<uint64_t>(checkpointInterval, 1)),
+      recorder(recorder), inputLog(recorder ? recorder->log.interrupts : ownInputLog)
+    {
+      for (uint16_t page = 0; page < vm.pages.size(); page++)
+      {
+        if (vm.pages[page].memory && vm.pages[page].writable)
+        {
+          std::copy(vm.pages[page].memory, vm.pages[page].memory + 0x100, shadow[page].begin());
+        }
+      }
+      vm.dirtyPages.fill(false);
+      vm.inputLog = &inputLog;
+      vm.ioReadLog = &ioReadLog;
+
+      takeCheckpoint();
+    }
+
+    // The recorder's log stays attached to vm
+    ~RewindHistory()
+    {
+      if (!recorder)
+      {
+        vm.inputLog = nullptr;
+      }
+      vm.ioReadLog = nullptr;
+    }
+
+    // Call between runs, takes a checkpoint once checkpointInterval instructions
+    // have been executed since the last one
+    void update()
+    {
+      if (vm.instructionCount - checkpoints.back().instructionCount >= checkpointInterval)
+      {
+        takeCheckpoint();
+      }
+    }
+
+    // Goes back to just before the instruction at that distance, after any
+    // interrupts that arrived before it. Returns false, changing nothing, if the
+    // history does not reach back that far
+    bool stepBack(uint64_t instructions)
+    {
+      const uint64_t target = vm.instructionCount - std::min(instructions, vm.instructionCount);
+
+      auto checkpoint = std::upper_bound(checkpoints.begin(), checkpoints.end(), target,
+        [](uint64_t count, const Checkpoint& checkpoint)
+        {
+          return count < checkpoint.instructionCount;
+        });
+      if (checkpoint == checkpoints.begin())
+      {
+        return false;
+      }
+      --checkpoint;
+
+      // Back to the newest checkpoint, then undo one checkpoint at a time
+      undoPages(dirtyPages());
+      while (&checkpoints.back() != &*checkpoint)
+      {
+        checkpoints.pop_back();
+        undoPages(checkpoints.back().undo);
+        checkpoints.back().undo.clear();
+      }
+      vm.dirtyPages.fill(false);
+
+      StateReader processor(checkpoint->processor);
+      vm.loadProcessorState(processor);
+      vm.loadDeviceState(StateReader(checkpoint->devices));
+
+      // Replaying the interrupts and reads logs them again
+      std::vector<VirtMachine::InputEvent> replay(inputLog.begin() + checkpoint->inputLogSize, inputLog.end());
+      inputLog.resize(checkpoint->inputLogSize);
+      const std::vector<VirtMachine::IORead> reads(ioReadLog.begin() + checkpoint->ioReadLogSize, ioReadLog.end());
+      ioReadLog.resize(checkpoint->ioReadLogSize);
+      vm.ioReplay = reads.data();
+      vm.ioReplayEnd = reads.data() + reads.size();
+
+      size_t next = 0;
+      while (true)
+      {
+        while (next < replay.size() && replay[next].instructionCount <= vm.instructionCount)
+        {
+          vm.hardwareInterrupt(replay[next++].interruptID);
+        }
+
+        if (vm.instructionCount >= target)
+        {
+          break;
+        }
+
+        uint64_t until = target;
+        if (next < replay.size())
+        {
+          until = std::min(until, replay[next].instructionCount);
+        }
+
+        if (vm.run(until - vm.instructionCount) == 0)
+        {
+          break;
+        }
+      }
+
+      vm.ioReplay = nullptr;
+      vm.ioReplayEnd = nullptr;
+
+      // The recorder was not asked for the reads it logged the first time
+      if (recorder)
+      {
+        recorder->log.reads.resize(checkpoint->recordedReads);
+        for (size_t read = checkpoint->ioReadLogSize; read < ioReadLog.size(); read++)
+        {
+          if (recorder->records(ioReadLog[read].address))
+          {
+            recorder->log.reads.push_back(ioReadLog[read]);
+          }
+        }
+      }
+
+      recountSize();
+      return true;
+    }
+
+    // Instructions the history reaches back from the current one
+    uint64_t depth() const
+    {
+      return vm.instructionCount - checkpoints.front().instructionCount;
+    }
+
+    // Bytes used by checkpoints and the logs they replay, without the fixed copy
+    // of memory at the newest one
+    size_t size() const
+    {
+      return usedBytes + logSize();
+    }
+
+  private:
+    VirtMachine& vm;
+    const size_t memoryBudget;
+    const uint64_t checkpointInterval;
+    InputRecorder* const recorder;
+
+    struct UndoPage
+    {
+      uint8_t page;
+      std::array<uint8_t, 0x100> memory;
+    };
+
+    struct Checkpoint
+    {
+      uint64_t instructionCount;
+      size_t inputLogSize;
+      size_t ioReadLogSize;
+      size_t recordedReads; // Reads in the recorder's log
+      std::vector<uint8_t> processor;
+      std::vector<uint8_t> devices;
+      std::vector<UndoPage> undo; // Pages written before the next checkpoint, as they were at this one
+    };
+
+    std::deque<Checkpoint> checkpoints;
+    std::vector<VirtMachine::InputEvent> ownInputLog;
+    std::vector<VirtMachine::InputEvent>& inputLog; // The recorder's if there is one
+    std::vector<VirtMachine::IORead> ioReadLog;
+    size_t usedBytes = 0;
+
+    // Memory as it was at the newest checkpoint
+    std::array<std::array<uint8_t, 0x100>, 256> shadow;
+
+    static size_t checkpointSize(const Checkpoint& checkpoint)
+    {
+      return sizeof(Checkpoint) + checkpoint.processor.size() + checkpoint.devices.size() +
+        checkpoint.undo.size() * sizeof(UndoPage);
+    }
+
+    // Only what the oldest checkpoint can still replay
+    size_t logSize() const
+    {
+      return (inputLog.size() - checkpoints.front().inputLogSize) * sizeof(VirtMachine::InputEvent) +
+        (ioReadLog.size() - checkpoints.front().ioReadLogSize) * sizeof(VirtMachine::IORead);
+    }
+
+    std::vector<UndoPage> dirtyPages() const
+    {
+      std::vector<UndoPage> pages;
+      for (uint16_t page = 0; page < vm.pages.size(); page++)
+      {
+        if (vm.dirtyPages[page] && vm.pages[page].memory && vm.pages[page].writable)
+        {
+          pages.push_back({uint8_t(page), shadow[page]});
+        }
+      }
+
+      return pages;
+    }
+
+    void undoPages(const std::vector<UndoPage>& pages)
+    {
+      for (const UndoPage& undo: pages)
+      {
+        std::copy(undo.memory.begin(), undo.memory.end(), vm.pages[undo.page].memory);
+        shadow[undo.page] = undo.memory;
+        vm.invalidateDecodeCache(undo.page << 8, undo.page << 8 | 0xFF);
+      }
+    }
+
+    void takeCheckpoint()
+    {
+      if (!checkpoints.empty())
+      {
+        Checkpoint& previous = checkpoints.back();
+        previous.undo = dirtyPages();
+        for (const UndoPage& undo: previous.undo)
+        {
+          std::copy(vm.pages[undo.page].memory, vm.pages[undo.page].memory + 0x100, shadow[undo.page].begin());
+        }
+        usedBytes += previous.undo.size() * sizeof(UndoPage);
+        vm.dirtyPages.fill(false);
+      }
+
+      Checkpoint& checkpoint = checkpoints.emplace_back();
+      checkpoint.instructionCount = vm.instructionCount;
+      checkpoint.inputLogSize = inputLog.size();
+      checkpoint.ioReadLogSize = ioReadLog.size();
+      checkpoint.recordedReads = recorder ? recorder->log.reads.size() : 0;
+      StateWriter processor(checkpoint.processor);
+      vm.saveProcessorState(processor);
+      StateWriter devices(checkpoint.devices);
+      vm.saveDeviceState(devices);
+      usedBytes += checkpointSize(checkpoint);
+
+      // The oldest checkpoints are only needed to get back to themselves
+      while (usedBytes + logSize() > memoryBudget && checkpoints.size() > 1)
+      {
+        usedBytes -= checkpointSize(checkpoints.front());
+        checkpoints.pop_front();
+      }
+
+      // Interrupts and reads before the oldest checkpoint are never replayed. The
+      // recorder's interrupts are kept, they are part of the recording
+      const size_t unreachableInterrupts = recorder ? 0 : checkpoints.front().inputLogSize;
+      if (unreachableInterrupts > inputLog.size() / 2)
+      {
+        inputLog.erase(inputLog.begin(), inputLog.begin() + unreachableInterrupts);
+        for (Checkpoint& checkpoint: checkpoints)
+        {
+          checkpoint.inputLogSize -= unreachableInterrupts;
+        }
+      }
+
+      const size_t unreachableReads = checkpoints.front().ioReadLogSize;
+      if (unreachableReads > ioReadLog.size() / 2)
+      {
+        ioReadLog.erase(ioReadLog.begin(), ioReadLog.begin() + unreachableReads);
+        for (Checkpoint& checkpoint: checkpoints)
+        {
+          checkpoint.ioReadLogSize -= unreachableReads;
+        }
+      }
+    }
+
+    void recountSize()
+    {
+      usedBytes = 0;
+      for (const Checkpoint& checkpoint: checkpoints)
+      {
+        usedBytes += checkpointSize(checkpoint);
+      }
+    }
+};
+
+#endif // EMULATOR_REWIND_HPP
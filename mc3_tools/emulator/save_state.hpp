@@ -0,0 +1,194 @@
+#ifndef EMULATOR_SAVE_STATE_HPP
+#define EMULATOR_SAVE_STATE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Appends little endian values to a save state held in memory
+class StateWriter
+{
+  public:
+    std::vector<uint8_t>& data;
+
+    explicit StateWriter(std::vector<uint8_t>& data): data(data) {}
+
+    void put(uint64_t value, int bytes)
+    {
+      for (int i = 0; i < bytes; i++)
+      {
+        data.push_back(uint8_t(value >> (i * 8)));
+      }
+    }
+
+    void put8(uint8_t value)
+    {
+      data.push_back(value);
+    }
+
+    void put16(uint16_t value)
+    {
+      put(value, 2);
+    }
+
+    void put32(uint32_t value)
+    {
+      put(value, 4);
+    }
+
+    void put64(uint64_t value)
+    {
+      put(value, 8);
+    }
+
+    void putBytes(const uint8_t* bytes, size_t size)
+    {
+      data.insert(data.end(), bytes, bytes + size);
+    }
+
+    // Reserves a 32-bit length for a block of variable size, finished by endBlock()
+    size_t beginBlock()
+    {
+      put32(0);
+      return data.size();
+    }
+
+    void endBlock(size_t start)
+    {
+      const uint32_t size = data.size() - start;
+      for (int i = 0; i < 4; i++)
+      {
+        data[start - 4 + i] = uint8_t(size >> (i * 8));
+      }
+    }
+};
+
+// Reads a save state back. Reading past the end returns zeros and sets failed,
+// so a truncated state can be read through completely and rejected afterwards
+class StateReader
+{
+  public:
+    bool failed = false;
+
+    StateReader(const uint8_t* data, size_t size): data(data), end(size) {}
+
+    explicit StateReader(const std::vector<uint8_t>& data): StateReader(data.data(), data.size()) {}
+
+    uint64_t get(int bytes)
+    {
+      if (position + bytes > end)
+      {
+        failed = true;
+        position = end;
+        return 0;
+      }
+
+      uint64_t value = 0;
+      for (int i = 0; i < bytes; i++)
+      {
+        value |= uint64_t(data[position++]) << (i * 8);
+      }
+
+      return value;
+    }
+
+    uint8_t get8()
+    {
+      return get(1);
+    }
+
+    uint16_t get16()
+    {
+      return get(2);
+    }
+
+    uint32_t get32()
+    {
+      return get(4);
+    }
+
+    uint64_t get64()
+    {
+      return get(8);
+    }
+
+    void getBytes(uint8_t* bytes, size_t size)
+    {
+      if (position + size > end)
+      {
+        failed = true;
+        position = end;
+        return;
+      }
+
+      std::memcpy(bytes, data + position, size);
+      position += size;
+    }
+
+    // A reader for the next block written with beginBlock() and endBlock(), this
+    // reader continues after it no matter how much of it is read
+    StateReader block()
+    {
+      const uint32_t size = get32();
+      if (position + size > end)
+      {
+        failed = true;
+        position = end;
+        return StateReader(data, 0);
+      }
+
+      StateReader result(data + position, size);
+      position += size;
+      return result;
+    }
+
+    void skip(size_t size)
+    {
+      if (position + size > end)
+      {
+        failed = true;
+        position = end;
+        return;
+      }
+
+      position += size;
+    }
+
+    size_t size() const
+    {
+      return end;
+    }
+
+    bool atEnd() const
+    {
+      return position == end;
+    }
+
+  private:
+    const uint8_t* data;
+    size_t position = 0;
+    size_t end;
+};
+
+inline bool writeStateFile(const std::string& filename, const std::vector<uint8_t>& state)
+{
+  std::ofstream file(filename, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(state.data()), state.size());
+  return bool(file);
+}
+
+inline std::vector<uint8_t> readStateFile(const std::string& filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  if (!file)
+  {
+    return {};
+  }
+
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+#endif // EMULATOR_SAVE_STATE_HPP
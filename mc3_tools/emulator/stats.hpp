@@ -0,0 +1,173 @@
+#ifndef EMULATOR_STATS_HPP
+#define EMULATOR_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "virt_machine.hpp"
+
+// A device on the I/O page, for the per-device counters
+struct DeviceRange
+{
+  const char* name;
+  uint16_t begin;
+  uint16_t end;
+};
+
+const std::vector<DeviceRange> defaultDeviceRanges = {
+  {"hdd", 0xFF00, 0xFF06},
+  {"tty", 0xFF07, 0xFF07},
+  {"vga", 0xFF08, 0xFF0D},
+  {"keyboard", 0xFF0E, 0xFF0F},
+  {"mouse", 0xFF10, 0xFF13},
+  {"speaker", 0xFF14, 0xFF16},
+  {"perf", 0xFF17, 0xFF1F},
+  {"dma", 0xFF20, 0xFF2D},
+  {"blitter", 0xFF2E, 0xFF3F}
+};
+
+// Writes vm.stats as a single line of JSON, with instructions executed in seconds
+// by this process. Operations that never executed are left out
+void writeStatsJson(std::ostream& out, const VirtMachine& vm, uint64_t instructions, double seconds,
+  const std::vector<DeviceRange>& ranges = defaultDeviceRanges)
+{
+  const VirtMachine::Stats& stats = vm.stats;
+
+  out << "{\"instructions\":" << instructions << ",\"seconds\":" << seconds << ",\"mips\":" <<
+    (seconds > 0 ? instructions / seconds / 1e6 : 0);
+
+  out << ",\"operations\":{";
+  bool first = true;
+  for (size_t operation = 1; operation < stats.operations.size(); operation++)
+  {
+    if (stats.operations[operation] != 0)
+    {
+      out << (first ? "" : ",") << '"' << VirtMachine::operationName(operation) << "\":" <<
+        stats.operations[operation];
+      first = false;
+    }
+  }
+  out << '}';
+
+  out << ",\"branches\":{\"taken\":" << stats.branchesTaken << ",\"notTaken\":" << stats.branchesNotTaken << '}';
+
+  out << ",\"interrupts\":{\"raised\":" << stats.interruptsRaised << ",\"dropped\":" << stats.interruptsDropped <<
+    ",\"ignored\":" << stats.interruptsIgnored << ",\"serviced\":" << stats.interruptsServiced << '}';
+
+  out << ",\"devices\":{";
+  for (size_t i = 0; i < ranges.size(); i++)
+  {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    for (uint16_t address = ranges[i].begin; address <= ranges[i].end; address++)
+    {
+      reads += stats.ioReads[address & 0xFF];
+      writes += stats.ioWrites[address & 0xFF];
+    }
+    out << (i == 0 ? "" : ",") << '"' << ranges[i].name << "\":{\"reads\":" << reads << ",\"writes\":" << writes << '}';
+  }
+  out << "}}\n";
+}
+
+// Sends the stats as JSON lines to a file, or to a Unix socket if the path
+// starts with "unix:", every interval while the program runs
+class StatsStream
+{
+  public:
+    StatsStream(const VirtMachine& vm, const std::string& path, std::chrono::milliseconds interval):
+      vm(vm), interval(interval), start(std::chrono::steady_clock::now()), last(start),
+      startInstructions(vm.instructionCount)
+    {
+      if (path.rfind("unix:", 0) == 0)
+      {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        const std::string socketPath = path.substr(5);
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+          return;
+        }
+        std::strcpy(address.sun_path, socketPath.c_str());
+
+        socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket >= 0 && connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+          close(socket);
+          socket = -1;
+        }
+      } else
+      {
+        file.open(path, std::ios::trunc);
+      }
+    }
+
+    ~StatsStream()
+    {
+      if (socket >= 0)
+      {
+        close(socket);
+      }
+    }
+
+    StatsStream(const StatsStream&) = delete;
+    StatsStream& operator=(const StatsStream&) = delete;
+
+    bool good() const
+    {
+      return socket >= 0 || file.good();
+    }
+
+    // Call between runs, writes the stats once the interval has passed
+    void update()
+    {
+      const auto now = std::chrono::steady_clock::now();
+      if (now - last >= interval)
+      {
+        last = now;
+        write();
+      }
+    }
+
+    void write()
+    {
+      std::ostringstream line;
+      writeStatsJson(line, vm, vm.instructionCount - startInstructions,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+      if (file.is_open())
+      {
+        file << line.str();
+        file.flush();
+      } else if (socket >= 0)
+      {
+        // A reader that went away just stops the stream
+        const std::string data = line.str();
+        if (send(socket, data.data(), data.size(), MSG_NOSIGNAL) != ssize_t(data.size()))
+        {
+          close(socket);
+          socket = -1;
+        }
+      }
+    }
+
+  private:
+    const VirtMachine& vm;
+    const std::chrono::milliseconds interval;
+    const std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    const uint64_t startInstructions; // Not 0 after loading a save state
+    std::ofstream file;
+    int socket = -1;
+};
+
+#endif // EMULATOR_STATS_HPP
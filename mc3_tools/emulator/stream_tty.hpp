@@ -0,0 +1,154 @@
+#ifndef EMULATOR_STREAM_TTY_HPP
+#define EMULATOR_STREAM_TTY_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "io_device.hpp"
+
+// Sends the characters the program writes to a host stream, stdout unless
+// redirected, and passes host input to the program. Output is collected and
+// written once per line instead of once per character. It is also written when
+// bufferSize characters are waiting, by update() once flushInterval has passed
+// and by flush(), which whoever owns the output stream calls before closing it.
+// Reads return the next input character, or 0 while there is none or after the
+// input ended. They never wait, the program polls
+class StreamTTY: public IODevice
+{
+  public:
+    std::ostream* output = &std::cout;
+    size_t bufferSize = 4096; // 1 writes every character at once
+    std::chrono::milliseconds flushInterval{100};
+
+    StreamTTY() = default;
+
+    StreamTTY(const StreamTTY&) = delete;
+    StreamTTY& operator=(const StreamTTY&) = delete;
+
+    ~StreamTTY()
+    {
+      closeInput();
+    }
+
+    // Reads input from filename, or from stdin for "-". Opening a FIFO waits
+    // until something opens it for writing. Returns false if it cannot be opened
+    bool openInput(const std::string& filename)
+    {
+      closeInput();
+      input = filename == "-" ? STDIN_FILENO : ::open(filename.c_str(), O_RDONLY);
+      return input >= 0;
+    }
+
+    // Until the input ended the program may still get characters
+    bool inputOpen() const
+    {
+      return input >= 0;
+    }
+
+    // Returns once input is available or timeout has passed
+    void waitForInput(std::chrono::milliseconds timeout)
+    {
+      if (input >= 0 && inputPosition == inputBuffer.size())
+      {
+        pollfd request{input, POLLIN, 0};
+        poll(&request, 1, timeout.count());
+      }
+    }
+
+    void flush()
+    {
+      if (!buffer.empty())
+      {
+        output->write(buffer.data(), buffer.size());
+        buffer.clear();
+      }
+      output->flush();
+      lastFlush = std::chrono::steady_clock::now();
+    }
+
+    // Call between runs, flushes output that has waited for flushInterval
+    void update()
+    {
+      if (!buffer.empty() && std::chrono::steady_clock::now() - lastFlush >= flushInterval)
+      {
+        flush();
+      }
+    }
+
+    uint8_t read(uint16_t address) override
+    {
+      if (inputPosition == inputBuffer.size() && !fillInput())
+      {
+        return 0;
+      }
+
+      return inputBuffer[inputPosition++];
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      buffer.push_back(value);
+      if (value == '\n' || buffer.size() >= bufferSize)
+      {
+        flush();
+      }
+    }
+
+  private:
+    std::string buffer;
+    std::chrono::steady_clock::time_point lastFlush = std::chrono::steady_clock::now();
+
+    int input = -1;
+    std::vector<uint8_t> inputBuffer;
+    size_t inputPosition = 0;
+
+    // Reads whatever input is available without waiting, false if there is none
+    bool fillInput()
+    {
+      if (input < 0)
+      {
+        return false;
+      }
+
+      pollfd request{input, POLLIN, 0};
+      if (poll(&request, 1, 0) <= 0)
+      {
+        return false;
+      }
+
+      inputBuffer.resize(4096);
+      const ssize_t count = ::read(input, inputBuffer.data(), inputBuffer.size());
+      inputPosition = 0;
+      if (count <= 0)
+      {
+        inputBuffer.clear();
+        if (count == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+          closeInput();
+        }
+        return false;
+      }
+
+      inputBuffer.resize(count);
+      return true;
+    }
+
+    void closeInput()
+    {
+      if (input > STDIN_FILENO)
+      {
+        ::close(input);
+      }
+      input = -1;
+    }
+};
+
+#endif // EMULATOR_STREAM_TTY_HPP
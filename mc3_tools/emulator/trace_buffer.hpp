@@ -0,0 +1,173 @@
+#ifndef EMULATOR_TRACE_BUFFER_HPP
+#define EMULATOR_TRACE_BUFFER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+#include "../mc3_utils.hpp"
+#include "../disassembler/disassemble_instruction.hpp"
+
+// Remembers the last instructions the machine executed. There is only ever one
+// writer, so recording is a plain store into the ring and a release store of
+// the entry count, and snapshot() can be called from any thread at any time.
+// Only what cannot be recovered later is recorded, the written register and
+// whether the address was accessed are decoded from the instruction in snapshot()
+class TraceBuffer
+{
+  public:
+    static constexpr uint8_t noRegister = 0xFF;
+
+    struct Entry
+    {
+      uint16_t pc;
+      uint16_t instruction; // The raw instruction word, first byte in the low byte
+      uint16_t address; // Only valid if accessesMemory is set
+      uint8_t reg; // The register written, or noRegister
+      bool accessesMemory;
+      bool instructionKnown; // Instructions executed from the I/O page are not read back
+    };
+
+    // The capacity is rounded up to a power of two
+    explicit TraceBuffer(size_t capacity):
+      capacity(std::bit_ceil(std::max<size_t>(capacity, 1))),
+      entries(std::make_unique<std::atomic<uint64_t>[]>(this->capacity))
+    {
+    }
+
+    // address is the memory operand's address, whether or not the instruction has one
+    void record(uint16_t pc, uint16_t instruction, bool instructionKnown, uint16_t address)
+    {
+      const uint64_t index = written.load(std::memory_order_relaxed);
+      entries[index & (capacity - 1)].store(uint64_t(pc) | uint64_t(instruction) << 16 | uint64_t(address) << 32 |
+        uint64_t(instructionKnown) << 48, std::memory_order_relaxed);
+      written.store(index + 1, std::memory_order_release);
+    }
+
+    // The recorded instructions, oldest first
+    std::vector<Entry> snapshot() const
+    {
+      const uint64_t end = written.load(std::memory_order_acquire);
+      const uint64_t begin = end > capacity ? end - capacity : 0;
+
+      std::vector<uint64_t> raw;
+      raw.reserve(end - begin);
+      for (uint64_t index = begin; index < end; index++)
+      {
+        raw.push_back(entries[index & (capacity - 1)].load(std::memory_order_relaxed));
+      }
+
+      // Entries the writer went past while they were copied may already be newer
+      // ones, so only those it cannot have reached yet are kept
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint64_t after = written.load(std::memory_order_relaxed);
+      const uint64_t firstValid = std::max(begin, after > capacity ? after - capacity : 0);
+
+      std::vector<Entry> result;
+      for (uint64_t index = std::min(firstValid, end); index < end; index++)
+      {
+        const uint64_t value = raw[index - begin];
+        result.push_back(decode(value));
+      }
+
+      return result;
+    }
+
+    // "MC3T", a 16-bit version and a 32-bit entry count, followed by 8 bytes per
+    // entry: pc, instruction and address as little endian words, the register, and
+    // a byte with the memory access flag in bit 0 and the instruction known flag in bit 1
+    void writeBinary(std::ostream& out) const
+    {
+      const std::vector<Entry> trace = snapshot();
+
+      out.write("MC3T", 4);
+      writeLittleEndian(out, binaryVersion, 2);
+      writeLittleEndian(out, trace.size(), 4);
+      for (const Entry& entry: trace)
+      {
+        writeLittleEndian(out, entry.pc, 2);
+        writeLittleEndian(out, entry.instruction, 2);
+        writeLittleEndian(out, entry.address, 2);
+        out.put(entry.reg);
+        out.put(entry.accessesMemory | entry.instructionKnown << 1);
+      }
+    }
+
+    void writeText(std::ostream& out) const
+    {
+      const std::vector<Entry> trace = snapshot();
+
+      out << "Last " << trace.size() << " instructions, oldest first:\n";
+      for (const Entry& entry: trace)
+      {
+        std::ostringstream line;
+        line << std::hex << std::setfill('0') << std::setw(4) << entry.pc << "  ";
+        if (entry.instructionKnown)
+        {
+          line << std::setw(2) << (entry.instruction & 0xFF) << std::setw(2) << (entry.instruction >> 8) << "  " <<
+            std::left << std::setfill(' ') << std::setw(20) <<
+            disassembleInstruction(entry.instruction & 0xFF, entry.instruction >> 8);
+        } else
+        {
+          line << "????  " << std::left << std::setfill(' ') << std::setw(20) << "(I/O page)";
+        }
+
+        if (entry.reg != noRegister)
+        {
+          line << "  writes r" << int(entry.reg);
+        }
+
+        if (entry.accessesMemory)
+        {
+          line << "  @" << std::right << std::setfill('0') << std::setw(4) << entry.address;
+        }
+
+        out << line.str() << '\n';
+      }
+    }
+
+  private:
+    static constexpr uint16_t binaryVersion = 1;
+
+    const size_t capacity;
+    std::unique_ptr<std::atomic<uint64_t>[]> entries;
+    std::atomic<uint64_t> written = 0;
+
+    static Entry decode(uint64_t value)
+    {
+      Entry entry{uint16_t(value), uint16_t(value >> 16), uint16_t(value >> 32), noRegister, false,
+        bool(value >> 48 & 1)};
+      if (!entry.instructionKnown)
+      {
+        return entry;
+      }
+
+      const Opcode opcode = Opcode((entry.instruction & 0xFF) >> 3);
+      const uint8_t second = entry.instruction >> 8;
+
+      entry.accessesMemory = opcode >= Opcode::LodB && opcode <= Opcode::StrW;
+      if (opcode <= Opcode::SubVal || (opcode == Opcode::SingleOp && SingleOpcode(second) != SingleOpcode::PutI) ||
+        (opcode >= Opcode::OrReg && opcode <= Opcode::LodW))
+      {
+        entry.reg = entry.instruction & 0x07;
+      }
+
+      return entry;
+    }
+
+    static void writeLittleEndian(std::ostream& out, uint64_t value, int bytes)
+    {
+      for (int i = 0; i < bytes; i++)
+      {
+        out.put(char(value >> (i * 8)));
+      }
+    }
+};
+
+#endif // EMULATOR_TRACE_BUFFER_HPP
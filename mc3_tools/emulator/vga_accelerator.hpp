@@ -0,0 +1,343 @@
+#ifndef EMULATOR_VGA_ACCELERATOR_HPP
+#define EMULATOR_VGA_ACCELERATOR_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "virt_machine.hpp"
+#include "io_device.hpp"
+#include "save_state.hpp"
+
+// Parameters of the VgaAccelerator commands. Eighteen bytes, all little endian:
+//   0-1    x            2-3    y
+//   4-5    width        6-7    height
+//   8      color
+//   9-10   source x     11-12  source y
+//   13-14  sprite address, width * height palette indices
+//   15-16  palette address, 0 if the indices are colors
+//   17     transparent index, sprite pixels with it are skipped
+class Blitter: public IODevice
+{
+  public:
+    uint8_t registers[18] = {};
+
+    uint16_t get16(uint8_t offset) const
+    {
+      return registers[offset] | registers[offset + 1] << 8;
+    }
+
+    uint8_t read(uint16_t address) override
+    {
+      return address < sizeof(registers) ? registers[address] : 0;
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      if (address < sizeof(registers))
+      {
+        registers[address] = value;
+      }
+    }
+
+    bool internalWrite(uint16_t address) const override
+    {
+      return true;
+    }
+
+    void saveState(StateWriter& state) const override
+    {
+      state.putBytes(registers, sizeof(registers));
+    }
+
+    bool loadState(StateReader& state) override
+    {
+      state.getBytes(registers, sizeof(registers));
+      return !state.failed && state.atEnd();
+    }
+};
+
+// Connected in front of the VGA, passes everything through to next, or to the
+// bus if there is none, and adds commands written to VGA_PUSH_COMMAND:
+//   AutoIncrement  pixel input where the VRAM pointer moves on after every
+//                  pixel, so runs of pixels are one write each
+//   FillRect       fills x, y, width, height with color
+//   CopyRect       copies width, height from source x, source y to x, y
+//   BlitSprite     draws the sprite at x, y, looking its indices up in the palette
+// Rectangles are clipped to the screen size last written to the VGA. The
+// commands draw one byte per pixel through the VGA's own registers, so they
+// leave it in pixel input mode, and every pixel counts as a memory cycle of the
+// VirtMachine timing model
+class VgaAccelerator: public IODevice
+{
+  public:
+    enum Command: uint8_t
+    {
+      PixelInput = 0,
+      AutoIncrement = 0x80,
+      FillRect = 0x81,
+      CopyRect = 0x82,
+      BlitSprite = 0x83
+    };
+
+    VgaAccelerator(VirtMachine& vm, const Blitter& blitter, IODevice* next = nullptr):
+      vm(vm), blitter(blitter), next(next) {}
+
+    uint8_t read(uint16_t address) override
+    {
+      return next ? next->read(address) : vm.bus.read(0xFF08 + address);
+    }
+
+    void write(uint16_t address, uint8_t value) override
+    {
+      if (address == 0)
+      {
+        command(value);
+        return;
+      }
+
+      if (!pixelMode)
+      {
+        // Width at 1-2, height at 3-4, both applied by the next command
+        if (address >= 1 && address <= 4)
+        {
+          uint16_t& size = address <= 2 ? width : height;
+          const uint8_t shift = (address - 1) % 2 * 8;
+          size = (size & ~(0xFF << shift)) | value << shift;
+        }
+        forward(address, value);
+        return;
+      }
+
+      if (address >= 1 && address <= 3)
+      {
+        const uint8_t shift = (address - 1) * 8;
+        pointer = (pointer & ~(uint32_t(0xFF) << shift)) | uint32_t(value) << shift;
+        forward(address, value);
+      } else if (address == 4)
+      {
+        if (pointer < vram.size())
+        {
+          vram[pointer] = value;
+        }
+        forward(address, value);
+
+        if (autoIncrement)
+        {
+          pointer++;
+          forwardPointer(pointer);
+        }
+      } else
+      {
+        forward(address, value);
+      }
+    }
+
+    // Repeated while rewinding so the shadow VRAM and the pointer follow the
+    // run, forward() keeps them from reaching the screen a second time
+    bool internalWrite(uint16_t address) const override
+    {
+      return true;
+    }
+
+    void saveState(StateWriter& state) const override
+    {
+      state.put8(pixelMode);
+      state.put8(autoIncrement);
+      state.put32(pointer);
+      state.put16(width);
+      state.put16(height);
+      state.put32(vram.size());
+      state.putBytes(vram.data(), vram.size());
+    }
+
+    bool loadState(StateReader& state) override
+    {
+      pixelMode = state.get8();
+      autoIncrement = state.get8();
+      pointer = state.get32();
+      width = state.get16();
+      height = state.get16();
+
+      const uint32_t size = state.get32();
+      if (state.failed || size > state.size())
+      {
+        return false;
+      }
+
+      vram.resize(size);
+      state.getBytes(vram.data(), size);
+      resync = true;
+      return !state.failed && state.atEnd();
+    }
+
+  private:
+    VirtMachine& vm;
+    const Blitter& blitter;
+    IODevice* const next;
+
+    bool pixelMode = false;
+    bool autoIncrement = false;
+    uint32_t pointer = 0; // The VRAM pointer as the program set it
+    uint16_t width = 0;
+    uint16_t height = 0;
+    std::vector<uint8_t> vram; // Every pixel written, CopyRect reads from here
+    bool resync = false; // The VGA may not be in the mode and at the pointer above
+
+    void forward(uint16_t address, uint8_t value)
+    {
+      if (vm.ioReplay)
+      {
+        resync = true;
+        return;
+      }
+
+      // The VGA is not part of save states and missed the replayed writes, so
+      // it is put back into pixel input mode at the pointer before going on
+      if (resync)
+      {
+        resync = false;
+        if (pixelMode)
+        {
+          forward(0, PixelInput);
+          forwardPointer(pointer);
+        }
+      }
+
+      if (next)
+      {
+        next->write(address, value);
+      } else
+      {
+        vm.bus.write(0xFF08 + address, value);
+      }
+    }
+
+    void forwardPointer(uint32_t value)
+    {
+      forward(1, value);
+      forward(2, value >> 8);
+      forward(3, value >> 16);
+    }
+
+    void command(uint8_t value)
+    {
+      switch (value)
+      {
+        case AutoIncrement:
+        case FillRect:
+        case CopyRect:
+        case BlitSprite:
+          if (!pixelMode)
+          {
+            forward(0, PixelInput);
+            pixelMode = true;
+          }
+
+          if (value == AutoIncrement)
+          {
+            autoIncrement = true;
+          } else
+          {
+            blit(value);
+            forwardPointer(pointer);
+          }
+          break;
+        default:
+          forward(0, value);
+          pixelMode = value == PixelInput;
+          autoIncrement = false;
+
+          // Any other command can apply a new screen size
+          if (!pixelMode)
+          {
+            vram.assign(size_t(width) * height, 0);
+          }
+          break;
+      }
+    }
+
+    void drawPixel(uint16_t x, uint16_t y, uint8_t color)
+    {
+      const uint32_t index = uint32_t(y) * width + x;
+      vram[index] = color;
+      forwardPointer(index);
+      forward(4, color);
+    }
+
+    void blit(uint8_t operation)
+    {
+      // The size can change without a command that clears the screen
+      if (vram.size() != size_t(width) * height)
+      {
+        vram.assign(size_t(width) * height, 0);
+      }
+
+      const uint16_t x = blitter.get16(0);
+      const uint16_t y = blitter.get16(2);
+      const uint16_t sourceX = blitter.get16(9);
+      const uint16_t sourceY = blitter.get16(11);
+
+      // Clipped so every pixel read and written is on the screen
+      uint16_t rectWidth = std::min<uint32_t>(blitter.get16(4), x < width ? width - x : 0);
+      uint16_t rectHeight = std::min<uint32_t>(blitter.get16(6), y < height ? height - y : 0);
+      if (operation == CopyRect)
+      {
+        rectWidth = std::min<uint32_t>(rectWidth, sourceX < width ? width - sourceX : 0);
+        rectHeight = std::min<uint32_t>(rectHeight, sourceY < height ? height - sourceY : 0);
+      }
+
+      switch (operation)
+      {
+        case FillRect:
+          for (uint16_t row = 0; row < rectHeight; row++)
+          {
+            for (uint16_t column = 0; column < rectWidth; column++)
+            {
+              drawPixel(x + column, y + row, blitter.registers[8]);
+            }
+          }
+          break;
+        case CopyRect: {
+          // Copied out first, so overlapping rectangles work
+          std::vector<uint8_t> pixels;
+          for (uint16_t row = 0; row < rectHeight; row++)
+          {
+            const auto begin = vram.begin() + (size_t(sourceY) + row) * width + sourceX;
+            pixels.insert(pixels.end(), begin, begin + rectWidth);
+          }
+
+          for (uint16_t row = 0; row < rectHeight; row++)
+          {
+            for (uint16_t column = 0; column < rectWidth; column++)
+            {
+              drawPixel(x + column, y + row, pixels[size_t(row) * rectWidth + column]);
+            }
+          }
+          break;
+        } case BlitSprite: {
+          // The sprite keeps its own width when it is clipped
+          const uint16_t spriteWidth = blitter.get16(4);
+          const uint16_t sprite = blitter.get16(13);
+          const uint16_t palette = blitter.get16(15);
+          const uint8_t transparent = blitter.registers[17];
+          for (uint16_t row = 0; row < rectHeight; row++)
+          {
+            for (uint16_t column = 0; column < rectWidth; column++)
+            {
+              const uint8_t index = vm.read(sprite + row * spriteWidth + column);
+              if (index != transparent)
+              {
+                drawPixel(x + column, y + row, palette ? vm.read(palette + index) : index);
+              }
+            }
+          }
+          break;
+        }
+      }
+
+      vm.memoryCycles += uint32_t(rectWidth) * rectHeight;
+    }
+};
+
+#endif // EMULATOR_VGA_ACCELERATOR_HPP
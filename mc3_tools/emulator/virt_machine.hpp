@@ -2,14 +2,30 @@
 #define EMULATOR_VIRT_MACHINE_HPP
 
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <array>
+#include <bit>
 #include <iostream>
+#include <limits>
+#include <utility>
+#include <vector>
 
 #include "emu-utils/bus.hpp"
 #include "../mc3_utils.hpp"
+#include "io_device.hpp"
+#include "save_state.hpp"
+#include "trace_buffer.hpp"
+
+// Computed goto is a GCC/Clang extension, other compilers always use the switch
+#if defined(__GNUC__) && !defined(MC3EMU_SWITCH_DISPATCH)
+#define MC3EMU_THREADED_DISPATCH 1
+#endif
 
 class VirtMachine
 {
+  friend class Jit;
+
   public:
     Bus<uint16_t> bus;
     uint16_t regs[8] = {0};
@@ -23,7 +39,31 @@ class VirtMachine
       bool overflow: 1;
       bool zero: 1;
       bool sign: 1; // MSB
-    } flags = {0, 0, 0, 0, 0};
+    };
+
+    // Flags are only fully computed when something reads them
+    Flags getFlags() const
+    {
+      Flags result = flags;
+      result.carry = carry;
+      result.overflow = overflow;
+      if (lazyFlags)
+      {
+        result.zero = flagResult == 0;
+        result.sign = flagResult >> 15;
+        result.bitsSet = std::popcount(flagResult) & 0xF;
+      }
+
+      return result;
+    }
+
+    void setFlags(Flags newFlags)
+    {
+      flags = newFlags;
+      carry = newFlags.carry;
+      overflow = newFlags.overflow;
+      lazyFlags = false;
+    }
 
     struct InterruptStateBackup
     {
@@ -100,333 +140,1776 @@ class VirtMachine
         bool full = false;
     } intQueue;
 
-    void hardwareInterrupt(uint16_t interruptID)
+    struct Page
     {
-      if (intVec == 0)
+      // If memory is null the page is I/O and every access goes through the bus
+      uint8_t* memory = nullptr;
+      bool writable = false;
+    };
+
+    // One entry per 256 byte page of the address space
+    std::array<Page, 256> pages{};
+
+    // Maps host memory to every page from begin to end, memory points to the first byte of begin's page
+    void mapMemory(uint16_t begin, uint16_t end, uint8_t* memory, bool writable = true)
+    {
+      for (uint16_t page = begin >> 8; page <= end >> 8; page++)
       {
-        return;
+        pages[page].memory = memory + ((page - (begin >> 8)) << 8);
+        pages[page].writable = writable;
       }
+    }
 
-      intQueue.push(interruptID);
+    // Devices connected here take priority over the bus, they must be within the I/O page
+    void connectDevice(IODevice* device, uint16_t begin, uint16_t end)
+    {
+      for (uint16_t address = begin; address <= end; address++)
+      {
+        ioDevices[address & 0xFF] = {device, begin};
+      }
     }
 
-    bool tickClock()
+    uint8_t read(uint16_t address)
     {
-      if (!running)
+      const Page& page = pages[address >> 8];
+      if (page.memory)
       {
-        return false;
+        return page.memory[address & 0xFF];
       }
 
-      if (pc >= 0xFFFE)
+      return ioRead(address);
+    }
+
+    uint16_t readWord(uint16_t address)
+    {
+      const Page& page = pages[address >> 8];
+      if constexpr (std::endian::native == std::endian::little)
       {
-        running = false;
+        // Words that cross into the next page are split into two byte reads
+        if (page.memory && (address & 0xFF) != 0xFF)
+        {
+          uint16_t value;
+          std::memcpy(&value, page.memory + (address & 0xFF), sizeof(value));
+          return value;
+        }
       }
 
-      handleInstruction();
-    
-      if (pc > 0x0001)
+      return (uint16_t)read(address) | ((uint16_t)read(address + 1) << 8);
+    }
+
+    void write(uint16_t address, uint8_t value)
+    {
+      const Page& page = pages[address >> 8];
+      if (page.memory)
+      {
+        // Writes to read only pages are ignored
+        if (page.writable)
+        {
+          page.memory[address & 0xFF] = value;
+          invalidateInstruction(address);
+        }
+      } else
       {
-        running = true;
+        ioWrite(address, value);
       }
+    }
 
-      if (intVec != 0 && !inInterrupt && !intQueue.empty())
+    void writeWord(uint16_t address, uint16_t value)
+    {
+      const Page& page = pages[address >> 8];
+      if constexpr (std::endian::native == std::endian::little)
       {
-        handleInterrupt();
+        if (page.memory && (address & 0xFF) != 0xFF)
+        {
+          if (page.writable)
+          {
+            std::memcpy(page.memory + (address & 0xFF), &value, sizeof(value));
+            invalidateInstruction(address);
+            invalidateInstruction(address + 1);
+          }
+          return;
+        }
       }
-      return running;
+
+      write(address, value & 0xFF);
+      write(address + 1, value >> 8);
     }
 
-  private:
-    bool running = true;
+    struct InputEvent
+    {
+      uint64_t instructionCount;
+      uint16_t interruptID;
+    };
+
+    // While set, every hardwareInterrupt() call is appended here with the
+    // instruction count it arrived at
+    std::vector<InputEvent>* inputLog = nullptr;
 
-    void handleInstruction()
+    struct IORead
     {
-      uint8_t first = bus.read(pc++);
-      uint8_t second = bus.read(pc++);
+      uint8_t address; // Low byte of the I/O address
+      uint8_t value;
+    };
 
-      switch (Opcode(first >> 3))
+    // While set, every read from the I/O page is appended here
+    std::vector<IORead>* ioReadLog = nullptr;
+
+    // While set, reads from the I/O page return the values from here to
+    // ioReplayEnd in order instead of reaching a device, and writes only reach
+    // devices whose IODevice::internalWrite() says so. Re-executed instructions
+    // see what they read the first time without doing anything outside the
+    // machine again
+    const IORead* ioReplay = nullptr;
+    const IORead* ioReplayEnd = nullptr;
+
+    // For interrupts from outside the machine, which are logged
+    void hardwareInterrupt(uint16_t interruptID)
+    {
+      if (inputLog)
       {
-        case Opcode::OrVal:
-          regs[first & 0x07] |= second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::AndVal:
-          regs[first & 0x07] &= second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::XorVal:
-          regs[first & 0x07] ^= second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::SingleOp:
-          switch (SingleOpcode(second))
-          {
-            case SingleOpcode::Not:
-              regs[first & 0x07] = ~regs[first & 0x07];
-              updateFlags(regs[first & 0x07]);
-              break;
-            case SingleOpcode::GetF:
-              regs[first & 0x07] = (flags.sign << 7) | (flags.zero << 6) | (flags.overflow << 5) | (flags.carry << 4) | flags.bitsSet;
-              updateFlags(regs[first & 0x07]);
-              break;
-            case SingleOpcode::PutI:
-              intVec = regs[first & 0x07];
-              break;
-          }
-          break;
-        /*case Opcode::LshVal:
-          flags.carry = regs[first & 0x07] >> (16-second);
+        inputLog->push_back({instructionCount, interruptID});
+      }
 
-          regs[first & 0x07] <<= second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::RshVal:
-          flags.carry = regs[first & 0x07] << (16-second);
+      deviceInterrupt(interruptID);
+    }
 
-          regs[first & 0x07] >>= second;
-          updateFlags(regs[first & 0x07]);
-          break;*/
-        case Opcode::AddVal:
-          flags.carry = uint16_t(regs[first & 0x07] + second) < second;
-          flags.overflow = (regs[first & 0x07] >> 15) == (second >> 15) && (regs[first & 0x07] + second) >> 15 != (regs[first & 0x07] >> 15);
+    // For interrupts a device raises in response to the program, which happen
+    // again whenever the program is re-executed and so are not logged
+    void deviceInterrupt(uint16_t interruptID)
+    {
+      if (intVec == 0)
+      {
+        stats.interruptsIgnored++;
+        return;
+      }
 
-          regs[first & 0x07] += second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::SubVal:
-          flags.carry = regs[first & 0x07] - second > second;
-          flags.overflow = (regs[first & 0x07] >> 15) != (second >> 15) && (regs[first & 0x07] + second) >> 15 != (regs[first & 0x07] >> 15);
+      if (intQueue.push(interruptID))
+      {
+        stats.interruptsRaised++;
+      } else
+      {
+        stats.interruptsDropped++;
+      }
+    }
 
-          regs[first & 0x07] -= second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::OrReg:
-          if (second & 1)
-          {
-            regs[first & 0x07] = regs[second >> 5] | ((second >> 1) & 0xF);
-          } else
-          {
-            regs[first & 0x07] = regs[second >> 5] | regs[(second >> 2) & 0x7];
-          }
+    struct Stats
+    {
+      // Only counted by run() with Features::Stats, indexed by the decoded
+      // operation, see operationName()
+      std::array<uint64_t, 40> operations{};
+      uint64_t branchesTaken = 0;
+      uint64_t branchesNotTaken = 0;
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::AndReg:
-          if (second & 1)
-          {
-            regs[first & 0x07] = regs[second >> 5] & ((second >> 1) & 0xF);
-          } else
-          {
-            regs[first & 0x07] = regs[second >> 5] & regs[(second >> 2) & 0x7];
-          }
+      // Always counted
+      uint64_t interruptsRaised = 0;
+      uint64_t interruptsDropped = 0; // The queue was full
+      uint64_t interruptsIgnored = 0; // No interrupt handler was set
+      uint64_t interruptsServiced = 0;
+      std::array<uint64_t, 256> ioReads{}; // Indexed by the low byte of the I/O page address
+      std::array<uint64_t, 256> ioWrites{};
+    } stats;
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::XorReg:
-          if (second & 1)
-          {
-            regs[first & 0x07] = regs[second >> 5] ^ ((second >> 1) & 0xF);
-          } else
-          {
-            regs[first & 0x07] = regs[second >> 5] ^ regs[(second >> 2) & 0x7];
-          }
+    // Instructions executed since the machine was created. run() keeps it
+    // current while it runs, so devices can read it mid-instruction
+    uint64_t instructionCount = 0;
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::LshReg:
-          if (second & 1)
-          {
-            flags.carry = regs[second >> 5] >> (16-((second >> 1) & 0xF));
-            regs[first & 0x07] = regs[second >> 5] << ((second >> 1) & 0xF);
-          } else
-          {
-            flags.carry = regs[second >> 5] >> (16-regs[(second >> 2)] & 0x7);
-            regs[first & 0x07] = regs[second >> 5] << regs[(second >> 2) & 0x7];
-          }
+    // The timing model: every instruction takes cyclesPerInstruction cycles to
+    // fetch and execute, plus one for every byte it loads or stores
+    static constexpr uint64_t cyclesPerInstruction = 2;
+    uint64_t memoryCycles = 0;
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::RshReg:
-          if (second & 1)
-          {
-            flags.carry = regs[second >> 5] << (16-((second >> 1) & 0xF));
-            regs[first & 0x07] = regs[second >> 5] >> ((second >> 1) & 0xF);
-          } else
-          {
-            flags.carry = regs[second >> 5] << (16-regs[(second >> 2)] & 0x7);
-            regs[first & 0x07] = regs[second >> 5] >> regs[(second >> 2) & 0x7];
-          }
+    uint64_t cycles() const
+    {
+      return instructionCount * cyclesPerInstruction + memoryCycles;
+    }
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::LrotReg:
-          if (second & 1)
-          {
-            flags.carry = regs[second >> 5] >> (16-((second >> 1) & 0xF));
-            regs[first & 0x07] = regs[second >> 5] << ((second >> 1) & 0xF) | regs[second >> 5] >> (16-((second >> 1) & 0xF));
-          } else
-          {
-            flags.carry = regs[second >> 5] >> (16-regs[(second >> 2)] & 0x7);
-            regs[first & 0x07] = regs[second >> 5] << regs[(second >> 2) & 0x7] | regs[second >> 5] >> (16-regs[(second >> 2) & 0x7]);
-          }
+    // Set for every page written through write() or by the program, whoever
+    // tracks changes to memory clears them
+    std::array<bool, 256> dirtyPages{};
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::RrotReg:
-          if (second & 1)
-          {
-            flags.carry = regs[second >> 5] << (16-((second >> 1) & 0xF));
-            regs[first & 0x07] = regs[second >> 5] >> ((second >> 1) & 0xF) | regs[second >> 5] << (16-((second >> 1) & 0xF));
-          } else
-          {
-            flags.carry = regs[second >> 5] << (16-regs[(second >> 2)] & 0x7);
-            regs[first & 0x07] = regs[second >> 5] >> regs[(second >> 2) & 0x7] | regs[second >> 5] << (16-regs[(second >> 2) & 0x7]);
-          }
+    // Switch decodes and executes instructions through one switch statement.
+    // Threaded jumps from the end of each instruction's handler straight to the
+    // next one through a table of label addresses, which gives the host branch
+    // predictor one indirect jump per handler to learn instead of one shared one
+    enum class Dispatch
+    {
+      Switch,
+      Threaded
+    };
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::AddReg:
-          if (second & 1)
-          {
-            flags.carry = regs[second >> 5] + ((second >> 1) & 0xF) < ((second >> 1) & 0xF);
-            flags.overflow = (regs[second >> 5] >> 15) == (((second >> 1) & 0xF) >> 15) && (regs[second >> 5] + ((second >> 1) & 0xF)) >> 15 != (regs[second >> 5] >> 15);
-            regs[first & 0x07] = regs[second >> 5] + ((second >> 1) & 0xF);
-          } else
-          {
-            flags.carry = regs[second >> 5] + regs[(second >> 2) & 0x7] < regs[(second >> 2) & 0x7];
-            flags.overflow = (regs[second >> 5] >> 15) == (regs[(second >> 2) & 0x7] >> 15) && (regs[second >> 5] + regs[(second >> 2) & 0x7]) >> 15 != (regs[second >> 5] >> 15);
-            regs[first & 0x07] = regs[second >> 5] + regs[(second >> 2) & 0x7];
-          }
+#ifdef MC3EMU_THREADED_DISPATCH
+    static constexpr Dispatch defaultDispatch = Dispatch::Threaded;
+#else
+    static constexpr Dispatch defaultDispatch = Dispatch::Switch;
+#endif
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::SubReg:
-          if (second & 1)
-          {
-            flags.carry = regs[second >> 5] - ((second >> 1) & 0xF) > ((second >> 1) & 0xF);
-            flags.overflow = (regs[second >> 5] >> 15) != (((second >> 1) & 0xF) >> 15) && (regs[second >> 5] + ((second >> 1) & 0xF)) >> 15 != (regs[second >> 5] >> 15);
-            regs[first & 0x07] = regs[second >> 5] - ((second >> 1) & 0xF);
-          } else
-          {
-            flags.carry = regs[second >> 5] - regs[(second >> 2) & 0x7] > regs[(second >> 2) & 0x7];
-            flags.overflow = (regs[second >> 5] >> 15) != (regs[(second >> 2) & 0x7] >> 15) && (regs[second >> 5] + regs[(second >> 2) & 0x7]) >> 15 != (regs[second >> 5] >> 15);
-            regs[first & 0x07] = regs[second >> 5] - regs[(second >> 2) & 0x7];
-          }
+    // Optional hooks into the execution loop. Each combination is its own
+    // instantiation of run(), so features that are not selected cost nothing:
+    //   Profile     counts every instruction in executionCounts
+    //   Trace       records every instruction in trace
+    //   Protect     halts on stores to read only addresses (see protectMemory)
+    //   Breakpoints stops run() before executing an instruction at a breakpoint
+    //   Stats       counts operations and branches in stats
+    enum class Features: uint8_t
+    {
+      None = 0,
+      Profile = 1,
+      Trace = 2,
+      Protect = 4,
+      Breakpoints = 8,
+      Stats = 16,
+      All = 31
+    };
 
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::SetVal:
-          regs[first & 0x07] = second;
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::LodB:
-          regs[first & 0x07] = bus.read(regs[second >> 6] + (int8_t(second << 2) >> 2));
-          updateFlags(regs[first & 0x07]);
-          break;
-        case Opcode::LodW: {
-          uint16_t address = regs[second >> 6] + (int8_t(second << 2) >> 2);
+    friend constexpr Features operator|(Features lhs, Features rhs)
+    {
+      return Features(uint8_t(lhs) | uint8_t(rhs));
+    }
 
-          regs[first & 0x07] = (uint16_t)bus.read(address) | ((uint16_t)bus.read(address + 1) << 8);
-          updateFlags(regs[first & 0x07]);
-          break;
-        } case Opcode::StrB:
-          bus.write(regs[second >> 6] + (int8_t(second << 2) >> 2), regs[first & 0x07]);
-          break;
-        case Opcode::StrW: {
-          uint16_t address = regs[second >> 6] + (int8_t(second << 2) >> 2);
+    static constexpr bool has(Features set, Features feature)
+    {
+      return (uint8_t(set) & uint8_t(feature)) != 0;
+    }
 
-          /*if (address >= 0xFF00)
-          {
-            std::cout << "Write " << regs[first & 0x07] << " to " << address << "\n";
-          }*/
-          bus.write(address, regs[first & 0x07] & 0xFF);
-          bus.write(address + 1, regs[first & 0x07] >> 8);
-          break;
-        } case Opcode::JmpZ:
-          if (flags.zero)
-          {
-            pc = regs[first & 0x07] + int8_t(second);
-          }
-          break;
-        case Opcode::JmpNz:
-          if (!flags.zero)
-          {
-            pc = regs[first & 0x07] + int8_t(second);
-          }
-          break;
-        case Opcode::JmpC:
-          if (flags.carry)
-          {
-            pc = regs[first & 0x07] + int8_t(second);
-          }
-          break;
-        case Opcode::JmpNc:
-          if (!flags.carry)
-          {
-            pc = regs[first & 0x07] + int8_t(second);
-          }
-          break;
-        case Opcode::JmpS:
-          if (flags.sign)
-          {
-            pc = regs[first & 0x07] + int8_t(second);
-          }
-          break;
-        case Opcode::JmpNs:
-          if (!flags.sign)
+    // Executes up to maxInstructions instructions and returns how many were executed,
+    // stopping early if the processor halts or gets stuck in an idle loop
+    uint64_t run(uint64_t maxInstructions)
+    {
+      return run<defaultDispatch>(maxInstructions);
+    }
+
+    template <Dispatch dispatch, Features features = Features::None>
+    uint64_t run(uint64_t maxInstructions)
+    {
+      if constexpr (dispatch == Dispatch::Threaded)
+      {
+#ifdef MC3EMU_THREADED_DISPATCH
+        return runThreaded<features>(maxInstructions);
+#else
+        static_assert(dispatch != Dispatch::Threaded, "Threaded dispatch needs computed goto support");
+#endif
+      }
+
+      inIdleLoop = false;
+      breakpointHit = false;
+
+      const uint64_t start = instructionCount;
+      const uint64_t end = start + std::min(maxInstructions, std::numeric_limits<uint64_t>::max() - start);
+      while (running && instructionCount < end)
+      {
+        if (waitingForInterrupt)
+        {
+          if (intQueue.empty())
           {
-            pc = regs[first & 0x07] + int8_t(second);
+            break;
           }
-          break;
-        case Opcode::JmpO:
-          if (flags.overflow)
+
+          handleInterrupt();
+        }
+
+        // The instruction run() starts at is always executed, so calling it again
+        // continues from a breakpoint
+        if constexpr (has(features, Features::Breakpoints))
+        {
+          if (instructionCount != start && isBreakpoint(pc))
           {
-            pc = regs[first & 0x07] + int8_t(second);
+            breakpointHit = true;
+            break;
           }
-          break;
-        case Opcode::JmpNo:
-          if (!flags.overflow)
+        }
+
+        if (pc >= 0xFFFE)
+        {
+          running = false;
+        }
+
+        uint16_t lastPc = pc;
+        profile<features>(pc);
+        const DecodedInstruction& instr = fetch();
+        traceInstruction<features>(lastPc, instr);
+        countInstruction<features>(instr);
+        if (instr.operation >= Operation::FarJump)
+        {
+          instructionCount += executeFused<features>(instr, lastPc, end - instructionCount);
+        } else
+        {
+          execute<Operation::Undecoded, features>(instr);
+          instructionCount++;
+        }
+
+        if constexpr (has(features, Features::Protect))
+        {
+          if (illegalWrite.occurred)
           {
-            pc = regs[first & 0x07] + int8_t(second);
+            break;
           }
-          break;
-        case Opcode::OpOnly:
-          switch (OnlyOpcode((((uint16_t)first & 0x7) << 8) | (uint16_t)second))
-          {
-            case OnlyOpcode::IRet:
-              inInterrupt = false;
+        }
 
-              std::copy(intState.regs, intState.regs + 8, regs);
-              pc = intState.pc;
-              flags = intState.flags;
-              break;
-          }
+        if (pc > 0x0001)
+        {
+          running = true;
+        }
+
+        // Only short backward jumps can close an idle loop, and only every
+        // idleCheckInterval-th one is checked to keep busy loops fast
+        if (uint16_t(lastPc - pc) <= maxIdleLoopLength && (++backwardJumps & (idleCheckInterval - 1)) == 0 &&
+          idleDetectionEnabled && idleLoopCompleted())
+        {
+          inIdleLoop = true;
           break;
+        }
+
+        if (intVec != 0 && !inInterrupt && !intQueue.empty())
+        {
+          handleInterrupt();
+        }
       }
+
+      return instructionCount - start;
     }
 
-    void updateFlags(uint16_t value)
+    bool tickClock()
+    {
+      run(1);
+
+      return running;
+    }
+
+    bool halted() const
+    {
+      return !running;
+    }
+
+    // True when the last run() stopped because the program is spinning in a loop
+    // that cannot make progress until a device changes or an interrupt arrives.
+    // Nothing is skipped, so running again just repeats the loop.
+    bool idle() const
+    {
+      return inIdleLoop;
+    }
+
+    bool idleDetectionEnabled = true;
+
+    // True while a WAIT instruction is waiting for an interrupt, run() executes
+    // nothing until hardwareInterrupt() is called
+    bool waiting() const
+    {
+      return waitingForInterrupt;
+    }
+
+    // Host-side writes to memory (program loading etc.) must invalidate the
+    // decoded copies of any instructions they overwrite
+    void invalidateDecodeCache(uint16_t begin = 0x0000, uint16_t end = 0xFFFF)
     {
-      flags.zero = value == 0;
-      flags.sign = value >> 15;
+      for (uint32_t slot = begin >> 1; slot <= uint32_t(end >> 1); slot++)
+      {
+        decodeCache[slot].operation = Operation::Undecoded;
+      }
+
+      // Sequences fused just before begin can reach into the range
+      for (uint32_t slot = std::max(int(begin >> 1) - (maxFusedLength - 1), 0); slot < uint32_t(begin >> 1); slot++)
+      {
+        if (decodeCache[slot].operation >= Operation::FarJump)
+        {
+          decodeCache[slot].operation = Operation::Undecoded;
+        }
+      }
 
-      flags.bitsSet = 0;
-      for (int i = 0; i < 16; i++)
+      for (uint32_t page = begin >> 8; page <= uint32_t(end >> 8); page++)
       {
-        if (value & (1 << i))
+        staleTranslationPages[page] = true;
+      }
+      translationsStale = true;
+    }
+
+    // When disabled every instruction is fetched and decoded from the bus again
+    bool decodeCacheEnabled = true;
+
+    // Marks begin to end (inclusive) as read only for run() with Features::Protect
+    void protectMemory(uint16_t begin, uint16_t end, bool readOnly = true)
+    {
+      for (uint32_t address = begin; address <= end; address++)
+      {
+        if (readOnly)
         {
-          flags.bitsSet++;
+          readOnlyAddresses[address >> 6] |= uint64_t(1) << (address & 63);
+        } else
+        {
+          readOnlyAddresses[address >> 6] &= ~(uint64_t(1) << (address & 63));
         }
       }
     }
 
+    bool isReadOnly(uint16_t address) const
+    {
+      return readOnlyAddresses[address >> 6] >> (address & 63) & 1;
+    }
+
+    // Set when a protected run halted the processor because a store targeted a
+    // read only address, the store itself is not executed
+    struct IllegalWrite
+    {
+      bool occurred = false;
+      uint16_t address = 0;
+      uint16_t pc = 0; // Address of the storing instruction
+    } illegalWrite;
+
+    // When enabled the decode cache recognizes the instruction sequences the
+    // compiler emits for far jumps and stack accesses, and executes each of
+    // them as one operation
+    bool fusionEnabled = true;
+
+    struct FusionStats
+    {
+      uint64_t farJumps = 0;
+      uint64_t stackAccesses = 0;
+      uint64_t fusedInstructions = 0; // Instructions executed as part of a fused sequence
+      uint64_t bailouts = 0; // Stack accesses cut short by a store into their own code or an interrupt
+    } fusionStats;
+
+    // With Features::Profile, every executed instruction increments its entry in
+    // this array of 0x8000 counters indexed by pc >> 1
+    uint64_t* executionCounts = nullptr;
+
+    // With Features::Trace, every executed instruction is recorded here. Fused
+    // sequences are executed one instruction at a time so each of them gets an entry
+    TraceBuffer* trace = nullptr;
+
+    void setBreakpoint(uint16_t address, bool enabled = true)
+    {
+      if (enabled)
+      {
+        breakpoints[address >> 6] |= uint64_t(1) << (address & 63);
+      } else
+      {
+        breakpoints[address >> 6] &= ~(uint64_t(1) << (address & 63));
+      }
+    }
+
+    bool isBreakpoint(uint16_t address) const
+    {
+      return breakpoints[address >> 6] >> (address & 63) & 1;
+    }
+
+    // True when the last run() stopped in front of a breakpoint, pc is its address
+    bool atBreakpoint() const
+    {
+      return breakpointHit;
+    }
+
+    // A save state holds the processor, the contents of every writable mapped page
+    // and the state of the devices connected with connectDevice that have any,
+    // keyed by the address they are connected at. Devices on the bus keep their
+    // own state. Protected memory, breakpoints and the other settings above
+    // belong to the host and are neither saved nor restored
+    static constexpr uint16_t stateVersion = 3;
+
+    // Replaces the contents of data, reusing its capacity
+    void saveState(std::vector<uint8_t>& data) const
+    {
+      data.clear();
+      StateWriter state(data);
+      state.putBytes(reinterpret_cast<const uint8_t*>("MC3S"), 4);
+      state.put16(stateVersion);
+
+      size_t block = state.beginBlock();
+      saveProcessorState(state);
+      state.endBlock(block);
+
+      block = state.beginBlock();
+      for (uint16_t page = 0; page < pages.size(); page++)
+      {
+        if (pages[page].memory && pages[page].writable)
+        {
+          state.put8(page);
+          state.putBytes(pages[page].memory, 0x100);
+        }
+      }
+      state.endBlock(block);
+
+      block = state.beginBlock();
+      saveDeviceState(state);
+      state.endBlock(block);
+    }
+
+    // Returns false, changing nothing, if data is not a save state of this
+    // version or does not fit the memory and devices of this machine. Only a
+    // device rejecting its own state can leave the machine partly restored
+    bool loadState(const std::vector<uint8_t>& data)
+    {
+      StateReader state(data);
+      uint8_t magic[4] = {};
+      state.getBytes(magic, 4);
+      if (std::memcmp(magic, "MC3S", 4) != 0 || state.get16() != stateVersion)
+      {
+        return false;
+      }
+
+      StateReader processor = state.block();
+      StateReader memory = state.block();
+      StateReader devices = state.block();
+      if (state.failed || !state.atEnd() || processor.size() != processorStateSize || memory.size() % 0x101 != 0)
+      {
+        return false;
+      }
+
+      for (StateReader check = memory; !check.atEnd(); check.skip(0x100))
+      {
+        const Page& page = pages[check.get8()];
+        if (!page.memory || !page.writable)
+        {
+          return false;
+        }
+      }
+
+      std::vector<std::pair<IODevice*, StateReader>> deviceStates;
+      if (!findDeviceStates(devices, deviceStates))
+      {
+        return false;
+      }
+
+      loadProcessorState(processor);
+
+      while (!memory.atEnd())
+      {
+        const uint8_t page = memory.get8();
+        memory.getBytes(pages[page].memory, 0x100);
+      }
+      invalidateDecodeCache();
+
+      return loadDeviceStates(deviceStates);
+    }
+
+    // The part of a save state holding the devices connected with connectDevice
+    void saveDeviceState(StateWriter& state) const
+    {
+      for (uint16_t address = 0; address < ioDevices.size(); address++)
+      {
+        // Each device once, at the first address it was connected at, and only if it has any state
+        if (ioDevices[address].device && ioDevices[address].base == (ioPage << 8 | address))
+        {
+          const size_t device = state.beginBlock();
+          state.put16(ioDevices[address].base);
+          ioDevices[address].device->saveState(state);
+          if (state.data.size() == device + 2)
+          {
+            state.data.resize(device - 4);
+          } else
+          {
+            state.endBlock(device);
+          }
+        }
+      }
+    }
+
+    // Returns false, changing nothing, if a state belongs to no device connected here
+    bool loadDeviceState(StateReader state)
+    {
+      std::vector<std::pair<IODevice*, StateReader>> deviceStates;
+      return findDeviceStates(state, deviceStates) && loadDeviceStates(deviceStates);
+    }
+
+    // The registers, interrupt state and everything else run() continues from,
+    // without memory or devices. Always processorStateSize bytes
+    void saveProcessorState(StateWriter& state) const
+    {
+      for (uint16_t reg: regs)
+      {
+        state.put16(reg);
+      }
+      state.put16(pc);
+      state.put16(intVec);
+      state.put8(packFlags(getFlags()));
+      for (uint16_t reg: intState.regs)
+      {
+        state.put16(reg);
+      }
+      state.put16(intState.pc);
+      state.put8(packFlags(intState.flags));
+      state.put8(inInterrupt);
+      state.put8(intQueue.size());
+      for (uint8_t i = 0; i < 16; i++)
+      {
+        state.put16(i < intQueue.size() ? intQueue[i] : 0);
+      }
+      state.put8(running);
+      state.put8(waitingForInterrupt);
+      state.put64(instructionCount);
+      state.put64(memoryCycles);
+      state.put8(illegalWrite.occurred);
+      state.put16(illegalWrite.address);
+      state.put16(illegalWrite.pc);
+
+      // Restored runs must stop in idle loops at the same instruction
+      state.put32(backwardJumps);
+      state.put64(stores);
+      state.put8(idleSnapshot.valid);
+      state.put16(idleSnapshot.loopStart);
+      for (uint16_t reg: idleSnapshot.regs)
+      {
+        state.put16(reg);
+      }
+      state.put8(idleSnapshot.flags);
+      state.put8(idleSnapshot.inInterrupt);
+      state.put64(idleSnapshot.stores);
+    }
+
+    void loadProcessorState(StateReader& state)
+    {
+      for (uint16_t& reg: regs)
+      {
+        reg = state.get16();
+      }
+      pc = state.get16();
+      intVec = state.get16();
+      setFlags(unpackFlags(state.get8()));
+      for (uint16_t& reg: intState.regs)
+      {
+        reg = state.get16();
+      }
+      intState.pc = state.get16();
+      intState.flags = unpackFlags(state.get8());
+      inInterrupt = state.get8();
+      intQueue = IntQueue();
+      const uint8_t queued = state.get8();
+      for (uint8_t i = 0; i < 16; i++)
+      {
+        const uint16_t id = state.get16();
+        if (i < queued)
+        {
+          intQueue.push(id);
+        }
+      }
+      running = state.get8();
+      waitingForInterrupt = state.get8();
+      instructionCount = state.get64();
+      memoryCycles = state.get64();
+      illegalWrite.occurred = state.get8();
+      illegalWrite.address = state.get16();
+      illegalWrite.pc = state.get16();
+
+      backwardJumps = state.get32();
+      stores = state.get64();
+      idleSnapshot.valid = state.get8();
+      idleSnapshot.loopStart = state.get16();
+      for (uint16_t& reg: idleSnapshot.regs)
+      {
+        reg = state.get16();
+      }
+      idleSnapshot.flags = state.get8();
+      idleSnapshot.inInterrupt = state.get8();
+      idleSnapshot.stores = state.get64();
+
+      inIdleLoop = false;
+      breakpointHit = false;
+    }
+
+    using RunFunction = uint64_t (VirtMachine::*)(uint64_t);
+
+    // The run() instantiation for a combination of features chosen at runtime
+    template <Dispatch dispatch = defaultDispatch>
+    static RunFunction runFunction(Features features)
+    {
+      return runFunctions<dispatch>(std::make_integer_sequence<uint8_t, uint8_t(Features::All) + 1>())[uint8_t(features)];
+    }
+
+  private:
+    bool running = true;
+
+    std::array<uint64_t, 0x10000 / 64> breakpoints{};
+    bool breakpointHit = false;
+
+    template <Dispatch dispatch, uint8_t... combination>
+    static constexpr std::array<RunFunction, sizeof...(combination)> runFunctions(
+      std::integer_sequence<uint8_t, combination...>)
+    {
+      return {&VirtMachine::run<dispatch, Features(combination)>...};
+    }
+
+    // Longest loop in bytes that is checked for making no progress
+    static constexpr uint16_t maxIdleLoopLength = 64;
+    static constexpr uint32_t idleCheckInterval = 16;
+
+    // Machine state the last time a short backward jump was checked. If a loop
+    // returns to the same start with the same registers and flags and without
+    // storing anything, the program is repeating itself and will keep doing so
+    struct IdleLoopSnapshot
+    {
+      bool valid = false;
+      uint16_t loopStart;
+      uint16_t regs[8];
+      uint8_t flags;
+      bool inInterrupt;
+      uint64_t stores;
+    } idleSnapshot;
+
+    bool inIdleLoop = false;
+    bool waitingForInterrupt = false;
+    uint32_t backwardJumps = 0;
+    uint64_t stores = 0;
+
+    static constexpr uint8_t ioPage = 0xFF;
+
+    struct IOMapping
+    {
+      IODevice* device = nullptr;
+      uint16_t base = 0;
+    };
+
+    // Indexed by the low byte of an address in the I/O page
+    std::array<IOMapping, 256> ioDevices{};
+
+    // regs, pc, intVec, flags, intState, inInterrupt, intQueue, running,
+    // waitingForInterrupt, instructionCount, illegalWrite and the idle loop detection
+    static constexpr size_t processorStateSize = 16 + 2 + 2 + 1 + 19 + 1 + 33 + 1 + 1 + 8 + 8 + 5 + 4 + 8 + 29;
+
+    bool findDeviceStates(StateReader devices, std::vector<std::pair<IODevice*, StateReader>>& deviceStates) const
+    {
+      while (!devices.atEnd())
+      {
+        StateReader deviceState = devices.block();
+        const uint16_t base = deviceState.get16();
+        if (!ioDevices[base & 0xFF].device || ioDevices[base & 0xFF].base != base)
+        {
+          return false;
+        }
+        deviceStates.emplace_back(ioDevices[base & 0xFF].device, deviceState);
+      }
+
+      return !devices.failed;
+    }
+
+    static bool loadDeviceStates(std::vector<std::pair<IODevice*, StateReader>>& deviceStates)
+    {
+      for (auto& [device, deviceState]: deviceStates)
+      {
+        if (!device->loadState(deviceState) || deviceState.failed)
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    uint8_t ioRead(uint16_t address)
+    {
+      if ((address >> 8) != ioPage)
+      {
+        return bus.read(address);
+      }
+
+      stats.ioReads[address & 0xFF]++;
+
+      const IOMapping& mapping = ioDevices[address & 0xFF];
+      uint8_t value;
+      if (ioReplay)
+      {
+        value = ioReplay != ioReplayEnd ? (ioReplay++)->value : 0;
+      } else if (mapping.device)
+      {
+        value = mapping.device->read(address - mapping.base);
+      } else
+      {
+        value = bus.read(address);
+      }
+
+      if (ioReadLog)
+      {
+        ioReadLog->push_back({uint8_t(address), value});
+      }
+
+      return value;
+    }
+
+    void ioWrite(uint16_t address, uint8_t value)
+    {
+      if ((address >> 8) != ioPage)
+      {
+        bus.write(address, value);
+        return;
+      }
+
+      stats.ioWrites[address & 0xFF]++;
+
+      const IOMapping& mapping = ioDevices[address & 0xFF];
+      if (ioReplay && !(mapping.device && mapping.device->internalWrite(address - mapping.base)))
+      {
+        return;
+      }
+
+      if (mapping.device)
+      {
+        mapping.device->write(address - mapping.base, value);
+        return;
+      }
+
+      bus.write(address, value);
+    }
+
+    // carry and overflow are kept outside of flags so they can be set with a
+    // plain byte store. zero, sign and bitsSet are derived from flagResult (the
+    // last ALU or load result) while lazyFlags is set, and read from flags otherwise
+    Flags flags = {0, 0, 0, 0, 0};
+    bool carry = false;
+    bool overflow = false;
+    uint16_t flagResult = 0;
+    bool lazyFlags = false;
+
+    bool zeroFlag() const
+    {
+      return lazyFlags ? flagResult == 0 : flags.zero;
+    }
+
+    bool signFlag() const
+    {
+      return lazyFlags ? flagResult >> 15 : flags.sign;
+    }
+
+    // Instructions are decoded into one of these, SingleOp and OpOnly are flattened
+    enum class Operation: uint8_t
+    {
+      Undecoded, // Zero, so a cleared cache entry is always invalid
+      Nop,
+      OrVal,
+      AndVal,
+      XorVal,
+      AddVal,
+      SubVal,
+      Not,
+      GetF,
+      PutI,
+      OrReg,
+      AndReg,
+      XorReg,
+      LshReg,
+      RshReg,
+      LrotReg,
+      RrotReg,
+      AddReg,
+      SubReg,
+      SetVal,
+      LodB,
+      LodW,
+      StrB,
+      StrW,
+      JmpZ,
+      JmpNz,
+      JmpC,
+      JmpNc,
+      JmpS,
+      JmpNs,
+      JmpO,
+      JmpNo,
+      IRet,
+      Wait,
+      // Fused sequences, these must stay last
+      FarJump, // set dX rY; add dX imm...; jmp dX
+      StackAccess // sub rX N; set/put rY size@rX-offset...; add rX N
+    };
+
+    static_assert(size_t(Operation::StackAccess) < std::tuple_size_v<decltype(Stats::operations)>);
+
+  public:
+    static const char* operationName(uint8_t operation)
+    {
+      static const char* const names[] = {
+        "Undecoded", "Nop", "OrVal", "AndVal", "XorVal", "AddVal", "SubVal", "Not", "GetF", "PutI", "OrReg", "AndReg",
+        "XorReg", "LshReg", "RshReg", "LrotReg", "RrotReg", "AddReg", "SubReg", "SetVal", "LodB", "LodW", "StrB",
+        "StrW", "JmpZ", "JmpNz", "JmpC", "JmpNc", "JmpS", "JmpNs", "JmpO", "JmpNo", "IRet", "Wait", "FarJump",
+        "StackAccess"
+      };
+      static_assert(std::size(names) == size_t(Operation::StackAccess) + 1);
+
+      return operation < std::size(names) ? names[operation] : "";
+    }
+
+  private:
+    struct DecodedInstruction
+    {
+      Operation operation;
+      uint8_t reg; // first & 0x07
+      uint8_t lhs; // register operand for Reg3 and memory operations
+      uint8_t rhs; // register operand for Reg3 operations
+      bool useValue; // Reg3 operations use value instead of rhs
+      uint8_t length; // Instructions in a fused sequence, the other fields describe its first one
+      uint16_t value; // immediate, already sign extended where the format is signed
+    };
+
+    static constexpr uint8_t maxFusedLength = 8;
+
+    // One entry per 16-bit instruction slot
+    std::array<DecodedInstruction, 0x8000> decodeCache{};
+
+    static DecodedInstruction decode(uint8_t first, uint8_t second)
+    {
+      DecodedInstruction result{};
+      result.operation = Operation::Nop;
+      result.reg = first & 0x07;
+
+      switch (Opcode(first >> 3))
+      {
+        case Opcode::OrVal:
+          result.operation = Operation::OrVal;
+          result.value = second;
+          break;
+        case Opcode::AndVal:
+          result.operation = Operation::AndVal;
+          result.value = second;
+          break;
+        case Opcode::XorVal:
+          result.operation = Operation::XorVal;
+          result.value = second;
+          break;
+        case Opcode::AddVal:
+          result.operation = Operation::AddVal;
+          result.value = second;
+          break;
+        case Opcode::SubVal:
+          result.operation = Operation::SubVal;
+          result.value = second;
+          break;
+        case Opcode::SetVal:
+          result.operation = Operation::SetVal;
+          result.value = second;
+          break;
+        case Opcode::SingleOp:
+          switch (SingleOpcode(second))
+          {
+            case SingleOpcode::Not:
+              result.operation = Operation::Not;
+              break;
+            case SingleOpcode::GetF:
+              result.operation = Operation::GetF;
+              break;
+            case SingleOpcode::PutI:
+              result.operation = Operation::PutI;
+              break;
+          }
+          break;
+        case Opcode::OrReg:
+        case Opcode::AndReg:
+        case Opcode::XorReg:
+        case Opcode::LshReg:
+        case Opcode::RshReg:
+        case Opcode::LrotReg:
+        case Opcode::RrotReg:
+        case Opcode::AddReg:
+        case Opcode::SubReg:
+          result.operation = Operation(uint8_t(Operation::OrReg) + (first >> 3) - uint8_t(Opcode::OrReg));
+          result.lhs = second >> 5;
+          result.rhs = (second >> 2) & 0x7;
+          result.useValue = second & 1;
+          result.value = (second >> 1) & 0xF;
+          break;
+        case Opcode::LodB:
+        case Opcode::LodW:
+        case Opcode::StrB:
+        case Opcode::StrW:
+          result.operation = Operation(uint8_t(Operation::LodB) + (first >> 3) - uint8_t(Opcode::LodB));
+          result.lhs = second >> 6;
+          result.value = int8_t(second << 2) >> 2;
+          break;
+        case Opcode::JmpZ:
+        case Opcode::JmpNz:
+        case Opcode::JmpC:
+        case Opcode::JmpNc:
+        case Opcode::JmpS:
+        case Opcode::JmpNs:
+        case Opcode::JmpO:
+        case Opcode::JmpNo:
+          result.operation = Operation(uint8_t(Operation::JmpZ) + (first >> 3) - uint8_t(Opcode::JmpZ));
+          result.value = int8_t(second);
+          break;
+        case Opcode::OpOnly:
+          switch (OnlyOpcode((((uint16_t)first & 0x7) << 8) | (uint16_t)second))
+          {
+            case OnlyOpcode::IRet:
+              result.operation = Operation::IRet;
+              break;
+            case OnlyOpcode::Wait:
+              result.operation = Operation::Wait;
+              break;
+          }
+          break;
+      }
+
+      return result;
+    }
+
+#ifdef MC3EMU_THREADED_DISPATCH
+    // Same loop as run<Dispatch::Switch>, with the end of the loop and the
+    // fetch of the next instruction copied into every handler
+    template <Features features>
+    uint64_t runThreaded(uint64_t maxInstructions)
+    {
+      // In the same order as Operation
+      static const void* const handlers[] = {
+        &&handleNop, // Undecoded
+        &&handleNop,
+        &&handleOrVal,
+        &&handleAndVal,
+        &&handleXorVal,
+        &&handleAddVal,
+        &&handleSubVal,
+        &&handleNot,
+        &&handleGetF,
+        &&handlePutI,
+        &&handleOrReg,
+        &&handleAndReg,
+        &&handleXorReg,
+        &&handleLshReg,
+        &&handleRshReg,
+        &&handleLrotReg,
+        &&handleRrotReg,
+        &&handleAddReg,
+        &&handleSubReg,
+        &&handleSetVal,
+        &&handleLodB,
+        &&handleLodW,
+        &&handleStrB,
+        &&handleStrW,
+        &&handleJmpZ,
+        &&handleJmpNz,
+        &&handleJmpC,
+        &&handleJmpNc,
+        &&handleJmpS,
+        &&handleJmpNs,
+        &&handleJmpO,
+        &&handleJmpNo,
+        &&handleIRet,
+        &&handleWait,
+        &&handleFused,
+        &&handleFused
+      };
+      static_assert(std::size(handlers) == size_t(Operation::StackAccess) + 1);
+
+      inIdleLoop = false;
+      breakpointHit = false;
+
+      const uint64_t start = instructionCount;
+      const uint64_t end = start + std::min(maxInstructions, std::numeric_limits<uint64_t>::max() - start);
+      uint16_t lastPc;
+      const DecodedInstruction* instr;
+
+// Everything run<Dispatch::Switch> does between two instructions
+#define MC3EMU_DISPATCH_NEXT() \
+      instructionCount++; \
+      if constexpr (has(features, Features::Protect)) \
+      { \
+        if (illegalWrite.occurred) \
+        { \
+          goto done; \
+        } \
+      } \
+      if (pc > 0x0001) \
+      { \
+        running = true; \
+      } \
+      if (uint16_t(lastPc - pc) <= maxIdleLoopLength && (++backwardJumps & (idleCheckInterval - 1)) == 0 && \
+        idleDetectionEnabled && idleLoopCompleted()) \
+      { \
+        inIdleLoop = true; \
+        goto done; \
+      } \
+      if (intVec != 0 && !inInterrupt && !intQueue.empty()) \
+      { \
+        handleInterrupt(); \
+      } \
+      if (!running || instructionCount >= end || waitingForInterrupt) \
+      { \
+        goto next; \
+      } \
+      if constexpr (has(features, Features::Breakpoints)) \
+      { \
+        if (isBreakpoint(pc)) \
+        { \
+          breakpointHit = true; \
+          goto done; \
+        } \
+      } \
+      if (pc >= 0xFFFE) \
+      { \
+        running = false; \
+      } \
+      lastPc = pc; \
+      profile<features>(pc); \
+      instr = &fetch(); \
+      traceInstruction<features>(lastPc, *instr); \
+      countInstruction<features>(*instr); \
+      goto *handlers[uint8_t(instr->operation)];
+
+#define MC3EMU_HANDLER(operation) \
+      handle##operation: \
+        execute<Operation::operation, features>(*instr); \
+        MC3EMU_DISPATCH_NEXT()
+
+      // The slow path, for the first instruction and whenever a handler cannot
+      // go straight to the next instruction
+      next:
+      if (!running || instructionCount >= end)
+      {
+        goto done;
+      }
+
+      if (waitingForInterrupt)
+      {
+        if (intQueue.empty())
+        {
+          goto done;
+        }
+
+        handleInterrupt();
+      }
+
+      if constexpr (has(features, Features::Breakpoints))
+      {
+        if (instructionCount != start && isBreakpoint(pc))
+        {
+          breakpointHit = true;
+          goto done;
+        }
+      }
+
+      if (pc >= 0xFFFE)
+      {
+        running = false;
+      }
+
+      lastPc = pc;
+      profile<features>(pc);
+      instr = &fetch();
+      traceInstruction<features>(lastPc, *instr);
+      countInstruction<features>(*instr);
+      goto *handlers[uint8_t(instr->operation)];
+
+      handleNop:
+        MC3EMU_DISPATCH_NEXT()
+      MC3EMU_HANDLER(OrVal)
+      MC3EMU_HANDLER(AndVal)
+      MC3EMU_HANDLER(XorVal)
+      MC3EMU_HANDLER(AddVal)
+      MC3EMU_HANDLER(SubVal)
+      MC3EMU_HANDLER(Not)
+      MC3EMU_HANDLER(GetF)
+      MC3EMU_HANDLER(PutI)
+      MC3EMU_HANDLER(OrReg)
+      MC3EMU_HANDLER(AndReg)
+      MC3EMU_HANDLER(XorReg)
+      MC3EMU_HANDLER(LshReg)
+      MC3EMU_HANDLER(RshReg)
+      MC3EMU_HANDLER(LrotReg)
+      MC3EMU_HANDLER(RrotReg)
+      MC3EMU_HANDLER(AddReg)
+      MC3EMU_HANDLER(SubReg)
+      MC3EMU_HANDLER(SetVal)
+      MC3EMU_HANDLER(LodB)
+      MC3EMU_HANDLER(LodW)
+      MC3EMU_HANDLER(StrB)
+      MC3EMU_HANDLER(StrW)
+      MC3EMU_HANDLER(JmpZ)
+      MC3EMU_HANDLER(JmpNz)
+      MC3EMU_HANDLER(JmpC)
+      MC3EMU_HANDLER(JmpNc)
+      MC3EMU_HANDLER(JmpS)
+      MC3EMU_HANDLER(JmpNs)
+      MC3EMU_HANDLER(JmpO)
+      MC3EMU_HANDLER(JmpNo)
+      MC3EMU_HANDLER(IRet)
+      MC3EMU_HANDLER(Wait)
+      handleFused:
+        instructionCount += executeFused<features>(*instr, lastPc, end - instructionCount) - 1;
+        MC3EMU_DISPATCH_NEXT()
+
+#undef MC3EMU_HANDLER
+#undef MC3EMU_DISPATCH_NEXT
+
+      done:
+      return instructionCount - start;
+    }
+#endif
+
+    template <Features features>
+    void profile(uint16_t address)
+    {
+      if (has(features, Features::Profile) && executionCounts)
+      {
+        executionCounts[address >> 1]++;
+      }
+    }
+
+    template <Features features>
+    void traceInstruction(uint16_t address, const DecodedInstruction& instr)
+    {
+      if (has(features, Features::Trace) && trace)
+      {
+        // Reading the I/O page again could have side effects
+        const bool inMemory = pages[address >> 8].memory && (address & 0xFF) != 0xFF;
+        trace->record(address, inMemory ? readWord(address) : 0, inMemory, regs[instr.lhs] + int16_t(instr.value));
+      }
+    }
+
+    template <Features features>
+    void countInstruction(const DecodedInstruction& instr)
+    {
+      if constexpr (has(features, Features::Stats))
+      {
+        // Fusion is off, so fused heads are executed as their first instruction
+        Operation operation = instr.operation;
+        if (operation == Operation::FarJump)
+        {
+          operation = Operation::AddReg;
+        } else if (operation == Operation::StackAccess)
+        {
+          operation = Operation::SubVal;
+        }
+        stats.operations[uint8_t(operation)]++;
+      }
+    }
+
+    template <Features features>
+    void jump(bool condition, uint16_t target)
+    {
+      if (condition)
+      {
+        pc = target;
+      }
+
+      if constexpr (has(features, Features::Stats))
+      {
+        (condition ? stats.branchesTaken : stats.branchesNotTaken)++;
+      }
+    }
+
+    // Instructions that are not cached are decoded into here
+    DecodedInstruction uncachedInstruction;
+
+    // Returns the decoded instruction at pc and moves pc past it
+    const DecodedInstruction& fetch()
+    {
+      // I/O pages are never cached
+      if (decodeCacheEnabled && pages[pc >> 8].memory && !(pc & 1))
+      {
+        DecodedInstruction& cached = decodeCache[pc >> 1];
+        if (cached.operation == Operation::Undecoded)
+        {
+          uint16_t word = readWord(pc);
+
+          cached = decode(word & 0xFF, word >> 8);
+          if (fusionEnabled)
+          {
+            fuse(pc, cached);
+          }
+        }
+
+        pc += 2;
+        return cached;
+      }
+
+      uint8_t first = read(pc++);
+      uint8_t second = read(pc++);
+
+      uncachedInstruction = decode(first, second);
+      return uncachedInstruction;
+    }
+
+    static bool isJump(Operation operation)
+    {
+      return operation >= Operation::JmpZ && operation <= Operation::JmpNo;
+    }
+
+    static bool isMemoryAccess(Operation operation)
+    {
+      return operation >= Operation::LodB && operation <= Operation::StrW;
+    }
+
+    // Turns head into a fused operation if it starts one of the sequences
+    // assemble_ir.hpp emits for every jump and far stack access. Only sequences
+    // entirely within memory pages are fused
+    void fuse(uint16_t address, DecodedInstruction& head)
+    {
+      DecodedInstruction sequence[maxFusedLength];
+      uint8_t available = 0;
+      for (; available < maxFusedLength; available++)
+      {
+        const uint16_t componentAddress = address + available * 2;
+        if (componentAddress < address || !pages[componentAddress >> 8].memory)
+        {
+          break;
+        }
+
+        const uint16_t word = readWord(componentAddress);
+        sequence[available] = decode(word & 0xFF, word >> 8);
+      }
+
+      Operation fused = Operation::Undecoded;
+      uint8_t length = 1;
+      if (head.operation == Operation::AddReg && head.useValue && head.value == 0)
+      {
+        while (length < available && (sequence[length].operation == Operation::AddVal ||
+          sequence[length].operation == Operation::SubVal) && sequence[length].reg == head.reg)
+        {
+          length++;
+        }
+
+        if (length > 1 && length < available && isJump(sequence[length].operation) && sequence[length].reg == head.reg)
+        {
+          fused = Operation::FarJump;
+        }
+      } else if (head.operation == Operation::SubVal)
+      {
+        // Loads into the base register would move the following accesses
+        while (length < available && isMemoryAccess(sequence[length].operation) && sequence[length].lhs == head.reg &&
+          !(sequence[length].operation <= Operation::LodW && sequence[length].reg == head.reg))
+        {
+          length++;
+        }
+
+        if (length > 1 && length < available && sequence[length].operation == Operation::AddVal &&
+          sequence[length].reg == head.reg && sequence[length].value == head.value)
+        {
+          fused = Operation::StackAccess;
+        }
+      }
+
+      if (fused == Operation::Undecoded)
+      {
+        return;
+      }
+
+      length++;
+      head.operation = fused;
+      head.length = length;
+
+      for (uint8_t i = 0; i < length; i++)
+      {
+        const uint16_t slot = (address >> 1) + i;
+        fusedSlots[slot >> 6] |= uint64_t(1) << (slot & 63);
+        if (i > 0 && decodeCache[slot].operation == Operation::Undecoded)
+        {
+          decodeCache[slot] = sequence[i];
+        }
+      }
+    }
+
+    // Instructions of a fused sequence are executed from their own cache entries
+    DecodedInstruction component(uint16_t address)
+    {
+      DecodedInstruction instr = decodeCache[address >> 1];
+      if (instr.operation == Operation::Undecoded || instr.operation >= Operation::FarJump)
+      {
+        const uint16_t word = readWord(address);
+        instr = decode(word & 0xFF, word >> 8);
+      }
+
+      return instr;
+    }
+
+    // pc is already past the first instruction of the sequence. Returns how
+    // many instructions were executed and moves lastPc to the last of them.
+    // Only the first instruction is executed if the whole sequence does not fit
+    // in the budget, or an interrupt is already waiting to be handled after it.
+    // Traces, breakpoints and stats need to see every instruction, so they disable fusion
+    template <Features features>
+    uint8_t executeFused(const DecodedInstruction& instr, uint16_t& lastPc, uint64_t budget)
+    {
+      const DecodedInstruction fused = instr;
+      const uint16_t head = pc - 2;
+      const bool whole = fusionEnabled && !has(features, Features::Trace) && !has(features, Features::Breakpoints) &&
+        !has(features, Features::Stats) &&
+        budget >= fused.length && !(intVec != 0 && !inInterrupt && !intQueue.empty());
+
+      if (fused.operation == Operation::FarJump)
+      {
+        execute<Operation::AddReg>(fused);
+        if (!whole)
+        {
+          return 1;
+        }
+
+        const uint16_t jump = head + (fused.length - 1) * 2;
+        for (uint16_t address = head + 2; address != jump; address += 2)
+        {
+          profile<features>(address);
+          const DecodedInstruction adjust = component(address);
+          if (adjust.operation == Operation::AddVal)
+          {
+            execute<Operation::AddVal>(adjust);
+          } else
+          {
+            execute<Operation::SubVal>(adjust);
+          }
+        }
+
+        pc = jump + 2;
+        profile<features>(jump);
+        execute(component(jump));
+        lastPc = jump;
+
+        fusionStats.farJumps++;
+        fusionStats.fusedInstructions += fused.length;
+        return fused.length;
+      }
+
+      execute<Operation::SubVal>(fused);
+      if (!whole)
+      {
+        return 1;
+      }
+
+      uint8_t executed = 1;
+      uint16_t address = head + 2;
+      for (; executed < fused.length - 1; executed++, address += 2)
+      {
+        profile<features>(address);
+        const DecodedInstruction access = component(address);
+        pc = address + 2;
+        switch (access.operation)
+        {
+          case Operation::LodB:
+            execute<Operation::LodB>(access);
+            break;
+          case Operation::LodW:
+            execute<Operation::LodW>(access);
+            break;
+          case Operation::StrB:
+            execute<Operation::StrB, features>(access);
+            break;
+          default:
+            execute<Operation::StrW, features>(access);
+            break;
+        }
+
+        // Stores into the sequence invalidate its head, the rest is then executed one by one
+        if (decodeCache[head >> 1].operation != Operation::StackAccess || (intVec != 0 && !inInterrupt && !intQueue.empty()) ||
+          (has(features, Features::Protect) && illegalWrite.occurred))
+        {
+          lastPc = address;
+          fusionStats.bailouts++;
+          fusionStats.fusedInstructions += executed + 1;
+          return executed + 1;
+        }
+      }
+
+      pc = address + 2;
+      profile<features>(address);
+      execute<Operation::AddVal>(component(address));
+      lastPc = address;
+
+      fusionStats.stackAccesses++;
+      fusionStats.fusedInstructions += fused.length;
+      return fused.length;
+    }
+
+    // The threaded engine passes the operation as a template argument, which
+    // reduces the switch to a single case in each of its handlers
+    template <Operation knownOperation = Operation::Undecoded, Features features = Features::None>
+    void execute(const DecodedInstruction& instr)
+    {
+      uint16_t& reg = regs[instr.reg];
+
+      switch (knownOperation == Operation::Undecoded ? instr.operation : knownOperation)
+      {
+        case Operation::Undecoded:
+        case Operation::Nop:
+          break;
+        case Operation::OrVal:
+          reg |= instr.value;
+          updateFlags(reg);
+          break;
+        case Operation::AndVal:
+          reg &= instr.value;
+          updateFlags(reg);
+          break;
+        case Operation::XorVal:
+          reg ^= instr.value;
+          updateFlags(reg);
+          break;
+        case Operation::Not:
+          reg = ~reg;
+          updateFlags(reg);
+          break;
+        case Operation::GetF:
+          reg = packFlags(getFlags());
+          updateFlags(reg);
+          break;
+        case Operation::PutI:
+          intVec = reg;
+          break;
+        case Operation::AddVal:
+          carry = uint16_t(reg + instr.value) < instr.value;
+          overflow = (reg >> 15) == (instr.value >> 15) && (reg + instr.value) >> 15 != (reg >> 15);
+
+          reg += instr.value;
+          updateFlags(reg);
+          break;
+        case Operation::SubVal:
+          carry = reg - instr.value > instr.value;
+          overflow = (reg >> 15) != (instr.value >> 15) && (reg + instr.value) >> 15 != (reg >> 15);
+
+          reg -= instr.value;
+          updateFlags(reg);
+          break;
+        case Operation::OrReg:
+          reg = regs[instr.lhs] | (instr.useValue ? instr.value : regs[instr.rhs]);
+          updateFlags(reg);
+          break;
+        case Operation::AndReg:
+          reg = regs[instr.lhs] & (instr.useValue ? instr.value : regs[instr.rhs]);
+          updateFlags(reg);
+          break;
+        case Operation::XorReg:
+          reg = regs[instr.lhs] ^ (instr.useValue ? instr.value : regs[instr.rhs]);
+          updateFlags(reg);
+          break;
+        case Operation::LshReg:
+          if (instr.useValue)
+          {
+            carry = regs[instr.lhs] >> (16-instr.value);
+            reg = regs[instr.lhs] << instr.value;
+          } else
+          {
+            carry = regs[instr.lhs] >> (16-regs[instr.rhs] & 0x7);
+            reg = regs[instr.lhs] << regs[instr.rhs];
+          }
+
+          updateFlags(reg);
+          break;
+        case Operation::RshReg:
+          if (instr.useValue)
+          {
+            carry = regs[instr.lhs] << (16-instr.value);
+            reg = regs[instr.lhs] >> instr.value;
+          } else
+          {
+            carry = regs[instr.lhs] << (16-regs[instr.rhs] & 0x7);
+            reg = regs[instr.lhs] >> regs[instr.rhs];
+          }
+
+          updateFlags(reg);
+          break;
+        case Operation::LrotReg:
+          if (instr.useValue)
+          {
+            carry = regs[instr.lhs] >> (16-instr.value);
+            reg = regs[instr.lhs] << instr.value | regs[instr.lhs] >> (16-instr.value);
+          } else
+          {
+            carry = regs[instr.lhs] >> (16-regs[instr.rhs] & 0x7);
+            reg = regs[instr.lhs] << regs[instr.rhs] | regs[instr.lhs] >> (16-regs[instr.rhs]);
+          }
+
+          updateFlags(reg);
+          break;
+        case Operation::RrotReg:
+          if (instr.useValue)
+          {
+            carry = regs[instr.lhs] << (16-instr.value);
+            reg = regs[instr.lhs] >> instr.value | regs[instr.lhs] << (16-instr.value);
+          } else
+          {
+            carry = regs[instr.lhs] << (16-regs[instr.rhs] & 0x7);
+            reg = regs[instr.lhs] >> regs[instr.rhs] | regs[instr.lhs] << (16-regs[instr.rhs]);
+          }
+
+          updateFlags(reg);
+          break;
+        case Operation::AddReg: {
+          uint16_t rhs = instr.useValue ? instr.value : regs[instr.rhs];
+
+          carry = regs[instr.lhs] + rhs < rhs;
+          overflow = (regs[instr.lhs] >> 15) == (rhs >> 15) && (regs[instr.lhs] + rhs) >> 15 != (regs[instr.lhs] >> 15);
+          reg = regs[instr.lhs] + rhs;
+
+          updateFlags(reg);
+          break;
+        } case Operation::SubReg: {
+          uint16_t rhs = instr.useValue ? instr.value : regs[instr.rhs];
+
+          carry = regs[instr.lhs] - rhs > rhs;
+          overflow = (regs[instr.lhs] >> 15) != (rhs >> 15) && (regs[instr.lhs] + rhs) >> 15 != (regs[instr.lhs] >> 15);
+          reg = regs[instr.lhs] - rhs;
+
+          updateFlags(reg);
+          break;
+        } case Operation::SetVal:
+          reg = instr.value;
+          updateFlags(reg);
+          break;
+        case Operation::LodB:
+          reg = read(regs[instr.lhs] + int16_t(instr.value));
+          memoryCycles += 1;
+          updateFlags(reg);
+          break;
+        case Operation::LodW:
+          reg = readWord(regs[instr.lhs] + int16_t(instr.value));
+          memoryCycles += 2;
+          updateFlags(reg);
+          break;
+        case Operation::StrB: {
+          const uint16_t address = regs[instr.lhs] + int16_t(instr.value);
+          if (has(features, Features::Protect) && isReadOnly(address))
+          {
+            stopOnIllegalWrite(address);
+            break;
+          }
+
+          write(address, reg);
+          stores++;
+          memoryCycles += 1;
+          break;
+        } case Operation::StrW: {
+          const uint16_t address = regs[instr.lhs] + int16_t(instr.value);
+          if (has(features, Features::Protect) && (isReadOnly(address) || isReadOnly(address + 1)))
+          {
+            stopOnIllegalWrite(isReadOnly(address) ? address : uint16_t(address + 1));
+            break;
+          }
+
+          writeWord(address, reg);
+          stores++;
+          memoryCycles += 2;
+          break;
+        }
+        case Operation::JmpZ:
+          jump<features>(zeroFlag(), reg + int16_t(instr.value));
+          break;
+        case Operation::JmpNz:
+          jump<features>(!zeroFlag(), reg + int16_t(instr.value));
+          break;
+        case Operation::JmpC:
+          jump<features>(carry, reg + int16_t(instr.value));
+          break;
+        case Operation::JmpNc:
+          jump<features>(!carry, reg + int16_t(instr.value));
+          break;
+        case Operation::JmpS:
+          jump<features>(signFlag(), reg + int16_t(instr.value));
+          break;
+        case Operation::JmpNs:
+          jump<features>(!signFlag(), reg + int16_t(instr.value));
+          break;
+        case Operation::JmpO:
+          jump<features>(overflow, reg + int16_t(instr.value));
+          break;
+        case Operation::JmpNo:
+          jump<features>(!overflow, reg + int16_t(instr.value));
+          break;
+        case Operation::IRet:
+          inInterrupt = false;
+
+          std::copy(intState.regs, intState.regs + 8, regs);
+          pc = intState.pc;
+          setFlags(intState.flags);
+          break;
+        case Operation::Wait:
+          // Nothing could end the wait if interrupts cannot be serviced
+          waitingForInterrupt = intVec != 0 && !inInterrupt;
+          break;
+        case Operation::FarJump:
+          execute<Operation::AddReg, features>(instr);
+          break;
+        case Operation::StackAccess:
+          execute<Operation::SubVal, features>(instr);
+          break;
+      }
+    }
+
+    // One bit per instruction slot that is part of a block translated by the JIT
+    std::array<uint64_t, 0x8000 / 64> translatedSlots{};
+    std::array<bool, 256> staleTranslationPages{};
+    bool translationsStale = false;
+
+    // One bit per address of the whole address space
+    std::array<uint64_t, 0x10000 / 64> readOnlyAddresses{};
+
+    // pc is already past the store
+    void stopOnIllegalWrite(uint16_t address)
+    {
+      illegalWrite = {true, address, uint16_t(pc - 2)};
+      running = false;
+    }
+
+    // One bit per instruction slot that is part of a fused sequence
+    std::array<uint64_t, 0x8000 / 64> fusedSlots{};
+
+    void invalidateInstruction(uint16_t address)
+    {
+      decodeCache[address >> 1].operation = Operation::Undecoded;
+      dirtyPages[address >> 8] = true;
+
+      const uint16_t slot = address >> 1;
+      if (translatedSlots[slot >> 6] & (uint64_t(1) << (slot & 63)))
+      {
+        staleTranslationPages[address >> 8] = true;
+        translationsStale = true;
+      }
+
+      if (fusedSlots[slot >> 6] & (uint64_t(1) << (slot & 63)))
+      {
+        // Any sequence fused from up to maxFusedLength - 1 slots back may include this one
+        for (uint16_t head = slot >= maxFusedLength - 1 ? slot - (maxFusedLength - 1) : 0; head < slot; head++)
+        {
+          if (decodeCache[head].operation >= Operation::FarJump)
+          {
+            decodeCache[head].operation = Operation::Undecoded;
+          }
+        }
+      }
+    }
+
+    static uint8_t packFlags(Flags current)
+    {
+      return (current.sign << 7) | (current.zero << 6) | (current.overflow << 5) | (current.carry << 4) | current.bitsSet;
+    }
+
+    static Flags unpackFlags(uint8_t packed)
+    {
+      return {uint8_t(packed & 0xF), bool(packed >> 4 & 1), bool(packed >> 5 & 1), bool(packed >> 6 & 1),
+        bool(packed >> 7)};
+    }
+
+    // Called after a short backward jump, pc is the start of the loop
+    bool idleLoopCompleted()
+    {
+      // A pending interrupt will break the loop
+      if (intVec != 0 && !inInterrupt && !intQueue.empty())
+      {
+        return false;
+      }
+
+      const uint8_t currentFlags = packFlags(getFlags());
+      if (idleSnapshot.valid && idleSnapshot.loopStart == pc && idleSnapshot.stores == stores &&
+        idleSnapshot.flags == currentFlags && idleSnapshot.inInterrupt == inInterrupt &&
+        std::equal(regs, regs + 8, idleSnapshot.regs))
+      {
+        return true;
+      }
+
+      idleSnapshot.valid = true;
+      idleSnapshot.loopStart = pc;
+      std::copy(regs, regs + 8, idleSnapshot.regs);
+      idleSnapshot.flags = currentFlags;
+      idleSnapshot.inInterrupt = inInterrupt;
+      idleSnapshot.stores = stores;
+      return false;
+    }
+
+    void updateFlags(uint16_t value)
+    {
+      flagResult = value;
+      lazyFlags = true;
+    }
+
     void handleInterrupt()
     {
+      stats.interruptsServiced++;
       inInterrupt = true;
+      waitingForInterrupt = false;
 
       std::copy(regs, regs + 8, intState.regs);
       intState.pc = pc;
-      intState.flags = flags;
+      intState.flags = getFlags();
 
       pc = intVec;
       regs[0] = intQueue.pop();
@@ -48,7 +48,8 @@ enum class SingleOpcode
 enum class OnlyOpcode
 {
   None = -1,
-  IRet
+  IRet,
+  Wait
 };
 
 enum class OperationType